@@ -51,110 +51,264 @@
 *******************************************************************************/
 
 #pragma once
-//初期値の設定
-int Chord_Value[8][2] = { {5,0},{7,0},{9,1},{9,1},{5,0},{7,0},{9,1},{9,1} };　//コードの記号を指定する値(8小節)。0番目に音程を表す値(C,C#,D,..,B)、1番目にコードの種類を表す値（メジャー,マイナー,...）
-int Pattern_Value[8] = { 0,0,0,0,0,0,0,0 }; //奏法を指定する値
-int Pitch = 0; //キーを指定する値
-int Tone = 0; //音色を指定する値
+
+//1にすると、オーディオコールバック中のメモリ確保・ミューテックス・ファイル入出力を検出する(デバッグ/テスト用)。
+//フックの本体はMain.cppにある。フックはグローバルのoperator newやlibcの関数を差し替えるので、
+//ホストに読み込まれる形式(VST3、AUなど)を含むビルドには入れず、スタンドアロンだけを作るビルドでだけ有効になる
+#ifndef CHORDP_RT_SAFETY_CHECKS
+ #define CHORDP_RT_SAFETY_CHECKS 0
+#endif
+
+#if CHORDP_RT_SAFETY_CHECKS && JucePlugin_Build_Standalone \
+	&& ! (JucePlugin_Build_VST || JucePlugin_Build_VST3 || JucePlugin_Build_AU || JucePlugin_Build_AUv3 || JucePlugin_Build_AAX || JucePlugin_Build_Unity)
+ #define CHORDP_RT_SAFETY_HOOKS 1
+#else
+ #define CHORDP_RT_SAFETY_HOOKS 0
+#endif
+
+/*
+jpop
+rock
+jazz
+edm
+idol
+barade
+anime
+game
+*/
+//ジャンルごとに読み込まれるコードを設定
+const int Chord_g1[16][8][2] = { {{0,0},{7,0},{9,1},{4,1},{0,0},{7,0},{9,1},{7,0}},
+{{5,0},{7,0},{9,1},{9,1},{5,0},{7,0},{9,1},{9,1} },
+{ {0,0},{9,1},{5,0},{7,0},{0,0},{9,1},{5,0},{7,0} },
+{ {9,1},{5,0},{0,0},{5,0},{9,1},{5,0},{0,0},{5,0} },
+{ {2,3},{7,4},{0,2},{5,2},{11,2},{4,4},{7,1},{7,1} },
+{ {5,0},{0,0},{5,0},{0,0},{5,0},{0,0},{5,0},{0,0} },
+{ {5,0},{0,0},{9,1},{7,0},{5,0},{0,0},{9,1},{7,0} },
+{ {9,1},{7,0},{5,0},{0,0},{9,1},{7,0},{5,0},{0,0}  },
+{ {0,0},{9,1},{5,0},{7,0},{0,0},{9,1},{5,0},{7,0} },
+{ {9,1},{2,1},{7,0},{9,1},{9,1},{2,1},{7,0},{9,1} },
+{ {0,0},{7,0},{9,1},{7,0},{5,0},{0,0},{2,1},{7,0} },
+{ {9,1},{7,0},{5,0},{0,0},{9,0},{7,0},{5,0},{0,0} },
+{ {0,0},{5,0},{7,0},{0,0},{0,0},{5,0},{7,0},{0,0} },
+{ {5,0},{7,0},{4,1},{9,1},{5,0},{7,0},{4,1},{9,1}},
+{ {0,0},{5,0},{0,0},{7,0},{0,0},{5,0},{0,0},{7,0} },
+{ {9,1},{5,0},{7,0},{4,0},{9,1},{5,0},{7,0},{4,0} } };
 
 
 //==============================================================================
-/** A demo synth sound that's just a basic sine wave.. */
-class SineWaveSound : public SynthesiserSound
+/** コード進行の状態。小節ごとのコード(根音・種類)と奏法、キー、音色を持つ。
+	プラグインのインスタンスやオフラインレンダリングのジョブごとに1つずつ持てるよう、値としてコピーできる。 */
+class ChordProgression
 {
 public:
-	SineWaveSound() {}
+	static constexpr int maxBars = 64;
+	static constexpr int numChordTypes = 7;
+	static constexpr int numPatterns = 5;
+	static constexpr int numTones = 5;
+	static constexpr int minPitch = -12, maxPitch = 12;
+
+	//初期値の設定(全小節が同じ既定のチャンクを共有する)
+	ChordProgression()
+	{
+		for (auto& chunk : chunks)
+			chunk = getDefaultChunk();
+	}
 
-	bool appliesToNote(int /*midiNoteNumber*/) override { return true; }
-	bool appliesToChannel(int /*midiChannel*/) override { return true; }
-};
+	int getNumBars() const noexcept { return numBars; }
+	int getRoot(int bar) const noexcept { return chunks[bar / barsPerChunk]->root[bar % barsPerChunk]; }
+	int getType(int bar) const noexcept { return chunks[bar / barsPerChunk]->type[bar % barsPerChunk]; }
+	int getPattern(int bar) const noexcept { return chunks[bar / barsPerChunk]->pattern[bar % barsPerChunk]; }
+	int getPitch() const noexcept { return pitch; }
+	int getTone() const noexcept { return tone; }
 
+	void setNumBars(int newNumBars) noexcept { numBars = jlimit(1, maxBars, newNumBars); }
+	void setPitch(int newPitch) noexcept { pitch = jlimit(minPitch, maxPitch, newPitch); }
+	void setTone(int newTone) noexcept { tone = jlimit(0, numTones - 1, newTone); }
 
+	void setChord(int bar, int root, int type)
+	{
+		if (getRoot(bar) == root && getType(bar) == type)
+			return;
 
-//==============================================================================
-/** As the name suggest, this class does the actual audio processing. */
-class JuceDemoPluginAudioProcessor : public AudioProcessor
-{
+		auto& chunk = getWritableChunk(bar);
+		chunk.root[bar % barsPerChunk] = (int8)root;
+		chunk.type[bar % barsPerChunk] = (int8)type;
+	}
 
-public:
-	//==============================================================================
-	JuceDemoPluginAudioProcessor()
-		: AudioProcessor(getBusesProperties()),
-		state(*this, nullptr, "state",
-			{ std::make_unique<AudioParameterFloat>("gain",  "Gain",           NormalisableRange<float>(0.0f, 1.0f), 0.9f),
-			  std::make_unique<AudioParameterFloat>("delay", "Delay Feedback", NormalisableRange<float>(0.0f, 1.0f), 0.5f) })
+	void setPattern(int bar, int newPattern)
 	{
-		// Add a sub-tree to store the state of our UI
-		lastPosInfo.resetToDefault();
+		if (getPattern(bar) != newPattern)
+			getWritableChunk(bar).pattern[bar % barsPerChunk] = (int8)newPattern;
+	}
 
-		state.state.addChild({ "uiState", { { "width",  400 }, { "height", 200 } }, {} }, -1, nullptr);
-		loadAudioFile();
+	bool operator== (const ChordProgression& other) const noexcept
+	{
+		if (numBars != other.numBars || pitch != other.pitch || tone != other.tone)
+			return false;
+
+		for (int i = 0; i < numChunks; i++)
+			if (chunks[i] != other.chunks[i] && std::memcmp(chunks[i]->root, other.chunks[i]->root, sizeof(BarChunk::root) * 3) != 0)
+				return false;
+
+		return true;
 	}
 
-	~JuceDemoPluginAudioProcessor() {}
+	bool operator!= (const ChordProgression& other) const noexcept { return !operator== (other); }
 
-	//==============================================================================
-	bool isBusesLayoutSupported(const BusesLayout& layouts) const override
+	//プラグインの状態とプリセットのファイルで共通のバイナリ形式(小節数, キー, 音色, 小節ごとに根音, 種類, 奏法を1バイトずつ)
+	void writeTo(OutputStream& out) const
 	{
-		// Only mono/stereo and input/output must have same layout
-		const auto& mainOutput = layouts.getMainOutputChannelSet();
-		const auto& mainInput = layouts.getMainInputChannelSet();
+		out.writeByte((char)numBars);
+		out.writeByte((char)pitch);
+		out.writeByte((char)tone);
+
+		for (int i = 0; i < numBars; i++) {
+			out.writeByte((char)getRoot(i));
+			out.writeByte((char)getType(i));
+			out.writeByte((char)getPattern(i));
+		}
+	}
 
-		// input and output layout must either be the same or the input must be disabled altogether
-		if (!mainInput.isDisabled() && mainInput != mainOutput)
-			return false;
+	//範囲外の値は丸めて読む
+	void readFrom(InputStream& in)
+	{
+		setNumBars((uint8)in.readByte());
+		setPitch((int8)in.readByte());
+		setTone(in.readByte());
+
+		for (int i = 0; i < numBars; i++) {
+			auto root = jlimit(0, 11, (int)in.readByte());
+			auto type = jlimit(0, numChordTypes - 1, (int)in.readByte());
+			setChord(i, root, type);
+			setPattern(i, jlimit(0, numPatterns - 1, (int)in.readByte()));
+		}
+	}
 
-		// do not allow disabling the main buses
-		if (mainOutput.isDisabled())
-			return false;
+	//ジャンルのプリセット(Chord_g1)のコードを読み込む
+	static constexpr int numGenrePresets = 16;
 
-		// only allow stereo and mono
-		if (mainOutput.size() > 2)
-			return false;
+	void loadGenrePreset(int n) noexcept
+	{
+		numBars = 8;
 
-		return true;
+		for (int i = 0; i < 8; i++) {
+			setChord(i, Chord_g1[n][i][0], Chord_g1[n][i][1]);
+		}
 	}
 
-	juce::AudioParameterFloat* speed;
-	int currentNote, lastNoteValue;
-	int time;
-	float rate;
-	juce::SortedSet<int> notes;
+private:
+	//小節のデータはbarsPerChunk小節ずつ参照カウント付きのチャンクに分けて持ち、コピーしたものどうしでチャンクを共有する。
+	//書き換えるときだけそのチャンクを複製する(コピーオンライト)ので、編集履歴の各版は変わったチャンクの分しか増えない
+	static constexpr int barsPerChunk = 8;
+	static constexpr int numChunks = maxBars / barsPerChunk;
 
+	struct BarChunk : public ReferenceCountedObject
+	{
+		using Ptr = ReferenceCountedObjectPtr<BarChunk>;
 
-	// プラグインをロードした時やホスト側のセットアップ処理を実行した時にホストから呼び出される。
-	void prepareToPlay(double newSampleRate, int samplesPerBlock) override
+		int8 root[barsPerChunk];    //コードの音程を表す値(C,C#,D,..,B)
+		int8 type[barsPerChunk];    //コードの種類を表す値（メジャー,マイナー,...）
+		int8 pattern[barsPerChunk]; //奏法を指定する値
+	};
+
+	static BarChunk::Ptr getDefaultChunk()
 	{
-		// Synthesiserオブジェクトにホストアプリケーションのサンプリングレートをセットする
-		synth.setCurrentPlaybackSampleRate(newSampleRate);
-		// MidiKeyboardStateオブジェクトの状態を初期化する
-		keyboardState.reset();
+		static const BarChunk::Ptr defaultChunk = []
+		{
+			const int initialChords[8][2] = { {5,0},{7,0},{9,1},{9,1},{5,0},{7,0},{9,1},{9,1} };
+			BarChunk::Ptr chunk(new BarChunk());
 
+			for (int i = 0; i < barsPerChunk; i++) {
+				chunk->root[i] = (int8)initialChords[i % 8][0];
+				chunk->type[i] = (int8)initialChords[i % 8][1];
+				chunk->pattern[i] = 0;
+			}
+
+			return chunk;
+		}();
 
+		return defaultChunk;
 	}
-	// プラグインを非アクティブ化した時や削除する時にホストから呼び出される。
-	void releaseResources() override
+
+	BarChunk& getWritableChunk(int bar)
 	{
-		// MidiKeyboardStateオブジェクトをオール・ノートOFF状態にする
-		keyboardState.allNotesOff(0);
-		// MidiKeyboardStateオブジェクトの状態を初期化する
-		keyboardState.reset();
+		auto& chunk = chunks[bar / barsPerChunk];
+
+		if (chunk->getReferenceCount() > 1)
+			chunk = new BarChunk(*chunk);
+
+		return *chunk;
 	}
 
-	void reset() override
+	BarChunk::Ptr chunks[numChunks];
+	int numBars = 8;
+	int pitch = 0;         //キーを指定する値
+	int tone = 0;          //音色を指定する値
+};
+
+
+//==============================================================================
+/** コード進行の編集履歴(メッセージスレッドで使う)。
+	各版はChordProgressionのコピーで、変わっていないチャンクは前後の版と共有するので、
+	1手あたりの大きさは変わったチャンクとチャンクの参照の分(100バイト程度)で済む。 */
+class ProgressionHistory
+{
+public:
+	static constexpr int maxSteps = 1000;
+
+	void reset(const ChordProgression& initial)
 	{
-		// Use this method as the place to clear any delay lines, buffers, etc, as it
-		// means there's been a break in the audio's continuity.
-		delayBufferFloat.clear();
-		delayBufferDouble.clear();
+		states.clear();
+		states.push_back(initial);
+		current = 0;
 	}
 
-	//==============================================================================
-	int beat_position[4] = { 5,5,17,17 };
-	int Chord_key[5] = { 0,0,0,0,0 };
+	//前の版から変わっていれば新しい版として積む(やり直しの分は捨てる)
+	bool push(const ChordProgression& next)
+	{
+		//版どうしでチャンクを共有するので、書き込むのはメッセージスレッドだけ
+		jassert(MessageManager::existsAndIsCurrentThread());
+
+		if (!states.empty() && states[(size_t)current] == next)
+			return false;
+
+		states.erase(states.begin() + jmin((int)states.size(), current + 1), states.end());
+		states.push_back(next);
 
+		if ((int)states.size() > maxSteps + 1)
+			states.pop_front();
+
+		current = (int)states.size() - 1;
+		return true;
+	}
+
+	bool canUndo() const noexcept { return current > 0; }
+	bool canRedo() const noexcept { return current + 1 < (int)states.size(); }
+
+	const ChordProgression& undo() { return states[(size_t)(canUndo() ? --current : current)]; }
+	const ChordProgression& redo() { return states[(size_t)(canRedo() ? ++current : current)]; }
+
+private:
+	std::deque<ChordProgression> states;
+	int current = 0;
+};
+
+
+//==============================================================================
+/** 1ステップ(16分音符)で鳴らすノート */
+struct ChordStep
+{
+	int numNotes = 0;
+	int notes[8];
+	bool clearsKeyboard = false; //画面の鍵盤表示をリセットするステップ
+};
+
+/** コード進行と奏法から、各ステップで鳴らすノートを決める。
+	processBlock、オフラインレンダリング、MIDI書き出しはすべてここを通る。 */
+struct ChordStepEngine
+{
 	//コードの種類と使用音を紐付ける
-	void ChordKeyCheck(int key[5], int v) {
+	static void ChordKeyCheck(int key[5], int v) {
 		switch (v) {
 		case 0://major
 			break;
@@ -186,1219 +340,6027 @@ public:
 		}
 	}
 
-
-	//アプリケーションからオーディオバッファとMIDIバッファの参照を取得してオーディオレンダリングを実行
-	void processBlock(AudioBuffer<float>& buffer, MidiBuffer& midiMessages) override
+	//奏法によって何拍目(step)で音を鳴らすか決定
+	//barChangedは小節が変わったとき、stepChangedはステップが変わったときにtrue
+	static ChordStep getStep(const ChordProgression& progression, int bar, int step, bool barChanged, bool stepChanged)
 	{
+		ChordStep result;
 
-		if (isChanging) {
-			return;
-		}
-
-		ScopedNoDenormals noDenormals;
-
-		int totalNumInputChannels = getTotalNumInputChannels();
-		int totalNumOutputChannels = getTotalNumOutputChannels();
-		int key_num = 48 + Pitch;
-		MidiMessage message[4];
-
-		//midiメッセージを追加
-		//奏法によって何拍目(beat_position)で音を鳴らすか決定
-
-			//ノートオン
-		if ((Pattern_Value[beat_position[0]] == 0) && (beat_position[0] != beat_position[1])) {
+		int Chord_key[5] = { 0,4,7,-1,-1 };
+		ChordKeyCheck(Chord_key, progression.getType(bar));
 
-			int Chord_key[5] = { 0,4,7,-1,-1 };
-			ChordKeyCheck(Chord_key, Chord_Value[beat_position[0]][1]);
+		int root = 48 + progression.getPitch() + progression.getRoot(bar);
+		int KEY = Chord_key[3] == -1 ? 2 : 3;
 
-			keyboardState.reset();
-			for (int i = 0; Chord_key[i] != -1; i++) {
-				message[i] = juce::MidiMessage::noteOn(1, key_num + Chord_Value[beat_position[0]][0] + Chord_key[i]/*noteNumber*/, (uint8)127);
-				midiMessages.addEvent(message[i], 0/*sample number*/);
+		auto add = [&result](int note) { result.notes[result.numNotes++] = note; };
+		auto addChord = [&] {
+			for (int i = 0; Chord_key[i] != -1; i++)
+				add(root + Chord_key[i]);
+		};
 
+		switch (progression.getPattern(bar)) {
+		case 0://Normal
+			if (barChanged) {
+				result.clearsKeyboard = true;
+				addChord();
 			}
+			break;
 
-
-		}
-
-		if (Pattern_Value[beat_position[0]] == 1) {
-			int Chord_key[5] = { 0,4,7,-1,-1 };
-			ChordKeyCheck(Chord_key, Chord_Value[beat_position[0]][1]);
-			int KEY = Chord_key[3] == -1 ? 2 : 3;
-
-			if ((beat_position[2] != beat_position[3])) {
-				if (beat_position[2] % 4 == 0) {
-					keyboardState.reset();
-
-					message[0] = juce::MidiMessage::noteOn(1, key_num + Chord_Value[beat_position[0]][0] + Chord_key[KEY]/*noteNumber*/, (uint8)127);
-					midiMessages.addEvent(message[0], 0/*sample number*/);
-					message[1] = juce::MidiMessage::noteOn(1, key_num + Chord_Value[beat_position[0]][0] + Chord_key[1] /*noteNumber*/, (uint8)127);
-					midiMessages.addEvent(message[1], 0/*sample number*/);
-
+		case 1://pop
+			if (stepChanged) {
+				if (step % 4 == 0) {
+					result.clearsKeyboard = true;
+					add(root + Chord_key[KEY]);
+					add(root + Chord_key[1]);
 				}
-				if (beat_position[2] % 4 == 2) {
-					keyboardState.reset();
-					message[0] = juce::MidiMessage::noteOn(1, key_num + Chord_Value[beat_position[0]][0] + Chord_key[0]/*noteNumber*/, (uint8)127);
-					midiMessages.addEvent(message[0], 0/*sample number*/);
-
+				if (step % 4 == 2) {
+					result.clearsKeyboard = true;
+					add(root + Chord_key[0]);
 				}
-
 			}
+			break;
 
-		}
-
-		if (Pattern_Value[beat_position[0]] == 2) {
-			int Chord_key[5] = { 0,4,7,-1,-1 };
-			ChordKeyCheck(Chord_key, Chord_Value[beat_position[0]][1]);
-			int KEY = Chord_key[3] == -1 ? 2 : 3;
-
-			if ((beat_position[2] != beat_position[3])) {
-				if (beat_position[2] % 8 == 0) {
-					keyboardState.reset();
-					message[0] = juce::MidiMessage::noteOn(1, key_num + Chord_Value[beat_position[0]][0] + Chord_key[0]/*noteNumber*/, (uint8)127);
-					midiMessages.addEvent(message[0], 0/*sample number*/);
-
-				}
-				if (beat_position[2] % 8 == 7) {
-					keyboardState.reset();
-					message[0] = juce::MidiMessage::noteOn(1, key_num + Chord_Value[beat_position[0]][0] + Chord_key[1]/*noteNumber*/, (uint8)127);
-					midiMessages.addEvent(message[0], 0/*sample number*/);
-
+		case 2://wave
+			if (stepChanged) {
+				switch (step % 8) {
+				case 0: add(root + Chord_key[0]); break;
+				case 7: add(root + Chord_key[1]); break;
+				case 1: case 6: add(root + Chord_key[KEY]); break;
+				case 2: case 5: add(root + Chord_key[0] + 12); break;
+				case 3: add(root + Chord_key[1] + 12); break;
+				case 4: add(root + Chord_key[KEY] + 12); break;
 				}
-				if (beat_position[2] % 8 == 1 || beat_position[2] % 8 == 6) {
-					keyboardState.reset();
-					message[0] = juce::MidiMessage::noteOn(1, key_num + Chord_Value[beat_position[0]][0] + Chord_key[KEY] /*noteNumber*/, (uint8)127);
-					midiMessages.addEvent(message[0], 0/*sample number*/);
+				result.clearsKeyboard = true;
+			}
+			break;
 
+		case 3://stylish
+			if (stepChanged) {
+				auto s = step % 16;
+				if (s == 0 || s == 4 || s == 7 || s == 9 || s == 12 || s == 14) {
+					result.clearsKeyboard = true;
+					addChord();
+					add(root + Chord_key[0]);
 				}
-				if (beat_position[2] % 8 == 2 || beat_position[2] % 8 == 5) {
-					keyboardState.reset();
-					message[0] = juce::MidiMessage::noteOn(1, key_num + Chord_Value[beat_position[0]][0] + Chord_key[0] + 12/*noteNumber*/, (uint8)127);
-					midiMessages.addEvent(message[0], 0/*sample number*/);
-
+				if (s == 2 || s == 6 || s == 11 || s == 13) {
+					result.clearsKeyboard = true;
+					add(root + Chord_key[0] - 12);
 				}
-				if (beat_position[2] % 8 == 3) {
-					keyboardState.reset();
-					message[0] = juce::MidiMessage::noteOn(1, key_num + Chord_Value[beat_position[0]][0] + Chord_key[1] + 12/*noteNumber*/, (uint8)127);
-					midiMessages.addEvent(message[0], 0/*sample number*/);
+				if (s == 8)
+					result.clearsKeyboard = true;
+			}
+			break;
 
+		case 4://Jazz
+			if (stepChanged) {
+				auto s = step % 8;
+				if (s == 0 || s == 2 || s == 6) {
+					result.clearsKeyboard = true;
+					add(root + Chord_key[0] - 12);
 				}
-				if (beat_position[2] % 8 == 4) {
-					keyboardState.reset();
-					message[0] = juce::MidiMessage::noteOn(1, key_num + Chord_Value[beat_position[0]][0] + Chord_key[KEY] + 12/*noteNumber*/, (uint8)127);
-					midiMessages.addEvent(message[0], 0/*sample number*/);
-
+				if (s == 1 || s == 4 || s == 7) {
+					result.clearsKeyboard = true;
+					addChord();
+					add(root + Chord_key[0]);
 				}
+				if (s == 3)
+					result.clearsKeyboard = true;
 			}
-			
-		
-		}
+			break;
 
-		if (Pattern_Value[beat_position[0]] == 3) {
-			int Chord_key[5] = { 0,4,7,-1,-1 };
-			ChordKeyCheck(Chord_key, Chord_Value[beat_position[0]][1]);
-			int KEY = Chord_key[3] == -1 ? 2 : 3;
-			if ((beat_position[2] != beat_position[3])) {
-				if (beat_position[2] % 16 == 0 || beat_position[2] % 16 == 4 || beat_position[2] % 16 == 7 || beat_position[2] % 16 == 9 || beat_position[2] % 16 == 12 || beat_position[2] % 16 == 14) {
-					keyboardState.reset();
-					for (int i = 0; Chord_key[i] != -1; i++) {
-						message[i] = juce::MidiMessage::noteOn(1, key_num + Chord_Value[beat_position[0]][0] + Chord_key[i]/*noteNumber*/, (uint8)127);
-						midiMessages.addEvent(message[i], 0/*sample number*/);
+		default:
+			break;
+		}
 
-					}
-					midiMessages.addEvent(message[0], 0/*sample number*/);
+		return result;
+	}
 
-				}
+	//拍子からステップの長さを求める(1小節 = 分子×4ステップ、ホストの拍子が不正なら4/4)
+	static int getQuarterNotesPerBar(int numerator, int denominator) noexcept
+	{
+		return (numerator > 0 && denominator > 0) ? jmax(1, numerator * 4 / denominator) : 4;
+	}
 
+	static int getStepsPerBar(int numerator) noexcept
+	{
+		return numerator > 0 ? numerator * 4 : 16;
+	}
 
-				if (beat_position[2] % 16 == 2 || beat_position[2] % 16 == 6 || beat_position[2] % 16 == 11 || beat_position[2] % 16 == 13) {
-					keyboardState.reset();
-					message[0] = juce::MidiMessage::noteOn(1, key_num + Chord_Value[beat_position[0]][0] + Chord_key[0] - 12/*noteNumber*/, (uint8)127);
-					midiMessages.addEvent(message[0], 0/*sample number*/);
+	static double getStepLength(int numerator, int denominator) noexcept
+	{
+		return getQuarterNotesPerBar(numerator, denominator) / (double)getStepsPerBar(numerator);
+	}
 
+	//曲頭からの通しの小節番号(進行の繰り返しで0に戻らない)
+	static int64 getBarIndex(int64 k, int numerator) noexcept
+	{
+		auto stepsPerBar = (int64)getStepsPerBar(numerator);
+		return k >= 0 ? k / stepsPerBar : (k + 1) / stepsPerBar - 1;
+	}
 
-				}
+	//小節の中での位置(0〜getStepsPerBar-1)。表示に使う。奏法のステップはこれを16で割った余り
+	static int getStepInBar(int64 k, int numerator) noexcept
+	{
+		return (int)(k - getBarIndex(k, numerator) * (int64)getStepsPerBar(numerator));
+	}
 
-				if (beat_position[2] % 16 == 8) {
-					keyboardState.reset();
+	//曲頭からの通しのステップ番号kを、進行の中の小節(0〜numBars-1)と奏法のステップ(0〜15)に変換する
+	static void getBarAndStep(int64 k, int numerator, int numBars, int& bar, int& step) noexcept
+	{
+		auto barIndex = getBarIndex(k, numerator);
 
-				}
-			}
-		}
+		bar = (int)(((barIndex % numBars) + numBars) % numBars);
+		step = getStepInBar(k, numerator) % 16;
+	}
 
+	//最後に鳴らした小節とステップを覚えておき、通しのステップkで鳴らすノートを求める。
+	//processBlockとMIDI書き出しが同じ規則で進むように、両方ともこれを使う
+	struct Cursor
+	{
+		int lastStep = -1; // -1はまだ鳴らしていない
+		int64 lastBarIndex = std::numeric_limits<int64>::min();
 
-		if (Pattern_Value[beat_position[0]] == 4) {
-			int Chord_key[5] = { 0,4,7,-1,-1 };
-			ChordKeyCheck(Chord_key, Chord_Value[beat_position[0]][1]);
-			int KEY = Chord_key[3] == -1 ? 2 : 3;
-			if ((beat_position[2] != beat_position[3])) {
+		//小節もステップも変わっていなければfalse。
+		//小節の変化は通しの小節番号で見るので、1小節の進行や先頭へ戻ったときも小節が変わったことになる
+		bool advance(const ChordProgression& progression, int64 k, int numerator, ChordStep& result)
+		{
+			int bar, step;
+			getBarAndStep(k, numerator, progression.getNumBars(), bar, step);
+			auto barIndex = getBarIndex(k, numerator);
 
-				if (beat_position[2] % 8 == 0 || beat_position[2] % 8 == 2 || beat_position[2] % 8 == 6) {
-					keyboardState.reset();
-					message[0] = juce::MidiMessage::noteOn(1, key_num + Chord_Value[beat_position[0]][0] + Chord_key[0] - 12/*noteNumber*/, (uint8)127);
-					midiMessages.addEvent(message[0], 0/*sample number*/);
+			auto barChanged = barIndex != lastBarIndex;
+			auto stepChanged = step != lastStep;
 
-				}
+			if (!barChanged && !stepChanged)
+				return false;
 
+			lastBarIndex = barIndex;
+			lastStep = step;
+			result = getStep(progression, bar, step, barChanged, stepChanged);
+			return true;
+		}
+	};
+};
 
 
-				if (beat_position[2] % 8 == 1 || beat_position[2] % 8 == 4 || beat_position[2] % 8 == 7) {
-					keyboardState.reset();
-					for (int i = 0; Chord_key[i] != -1; i++) {
-						message[i] = juce::MidiMessage::noteOn(1, key_num + Chord_Value[beat_position[0]][0] + Chord_key[i]/*noteNumber*/, (uint8)127);
-						midiMessages.addEvent(message[i], 0/*sample number*/);
+//==============================================================================
+/** デコード済みのサンプル。同じサンプルを使うボイスバンク(オフラインレンダリングのエンジンも含む)で共有する。 */
+class SharedSample : public ReferenceCountedObject
+{
+public:
+	using Ptr = ReferenceCountedObjectPtr<SharedSample>;
 
-					}
-					midiMessages.addEvent(message[0], 0/*sample number*/);
+	//SamplerSoundと同じくmaxLengthSecsで切り詰め、4サンプルの余白を付ける
+	SharedSample(AudioFormatReader& source, int rootNote, double attackSecs, double releaseSecs, double maxLengthSecs)
+		: sourceSampleRate(source.sampleRate), attackTime(attackSecs), releaseTime(releaseSecs), midiRootNote(rootNote)
+	{
+		length = sourceSampleRate > 0 ? jmin((int)source.lengthInSamples, (int)(maxLengthSecs * sourceSampleRate)) : 0;
 
-				}
+		data.setSize(jmin(2, (int)source.numChannels), length + 4);
+		data.clear();
+		source.read(&data, 0, length + 4, 0, true, true);
+	}
 
-				if (beat_position[2] % 8 == 3) {
-					keyboardState.reset();
+	AudioBuffer<float> data;
+	double sourceSampleRate = 0.0, attackTime = 0.0, releaseTime = 0.1;
+	int length = 0, midiRootNote = 60;
+};
 
-				}
-			}
-		}
+/** 内蔵のピアノ音源。SharedResourcePointerで持ち、デコードはプロセス内で1回だけ行う。 */
+struct BuiltInPiano
+{
+	BuiltInPiano()
+	{
+		AudioFormatManager formatManager;
+		formatManager.registerBasicFormats();
 
+		std::unique_ptr<AudioFormatReader> reader(formatManager.createReaderFor(
+			std::make_unique<MemoryInputStream>(BinaryData::piano_mp3, BinaryData::piano_mp3Size, false)));
 
+		if (reader != nullptr)
+			sample = new SharedSample(*reader, 60, 0, 0.1, 10.0);
+	}
 
+	SharedSample::Ptr sample;
+};
 
-		// MidiKeyboardStateオブジェクトのMIDIメッセージとMIDIバッファのMIDIメッセージをマージする
-		keyboardState.processNextMidiBuffer(midiMessages, 0, buffer.getNumSamples(), true);
 
-		// オーディオバッファのサンプルデータをクリア
-		for (auto i = totalNumInputChannels; i < totalNumOutputChannels; i++) {
-			buffer.clear(i, 0, buffer.getNumSamples());
-		}
-		//    // Synthesiserオブジェクトにオーディオバッファの参照とMIDIバッファの参照を渡して、オーディオレンダリング
-		synth.renderNextBlock(buffer, midiMessages, 0, buffer.getNumSamples());
+//==============================================================================
+/** A demo synth sound that's just a basic sine wave.. */
+class SineWaveSound : public SynthesiserSound
+{
+public:
+	SineWaveSound() {}
 
-		updateCurrentTimeInfoFromHost(beat_position);
-	}
+	bool appliesToNote(int /*midiNoteNumber*/) override { return true; }
+	bool appliesToChannel(int /*midiChannel*/) override { return true; }
+};
 
+//==============================================================================
+/** SamplerVoiceの代わりに全ボイスの状態を連続した配列(SoA)で持つサンプラー。
+	8ボイスずつレーンにまとめてブロック内のアキュムレータへミックスし、
+	出力バッファへの加算は1ブロックにつき1回だけ行う。 */
+class SamplerVoiceBank
+{
+public:
+	static constexpr int maxVoices = 128;
+	static constexpr int laneWidth = 8;        // 1回のSIMD演算でまとめるボイス数
+	static constexpr int maxChunkSize = 4096;  // アキュムレータの長さ
 
+	//補間の方法と1回に処理する長さ。リアルタイムでは軽い設定、オフラインの書き出しでは高品質にする
+	struct RenderQuality
+	{
+		bool hermiteInterpolation;
+		int chunkSize;
+	};
 
-	//==============================================================================
-	bool hasEditor() const override { return true; }
+	static RenderQuality getRealtimeQuality() noexcept { return { false, 512 }; }
+	static RenderQuality getOfflineQuality() noexcept { return { true, maxChunkSize }; }
 
-	AudioProcessorEditor* createEditor() override
+	SamplerVoiceBank()
 	{
-		return new JuceDemoPluginAudioProcessorEditor(*this);
+		accumulator.setSize(2, maxChunkSize);
+		clearVoices();
 	}
 
-	//==============================================================================
-	const String getName() const override { return "Chord Progressor"; }
-	bool acceptsMidi() const override { return true; }
-	bool producesMidi() const override { return true; }
-	double getTailLengthSeconds() const override { return 0.0; }
+	void setSample(SharedSample::Ptr newSample)
+	{
+		sample = newSample;
+		clearVoices();
+	}
 
-	//==============================================================================
-	int getNumPrograms() override { return 0; }
-	int getCurrentProgram() override { return 0; }
-	void setCurrentProgram(int) override {}
-	const String getProgramName(int) override { return {}; }
-	void changeProgramName(int, const String&) override {}
+	SharedSample::Ptr getSample() const { return sample; }
 
-	//==============================================================================
-	void getStateInformation(MemoryBlock& destData) override
+	void clearVoices()
 	{
-		// Store an xml representation of our state.
-		if (auto xmlState = state.copyState().createXml())
-			copyXmlToBinary(*xmlState, destData);
+		numActive = 0;
+		noteCounter = 0;
 	}
 
-	void setStateInformation(const void* data, int sizeInBytes) override
+	void setCurrentPlaybackSampleRate(double newRate)
 	{
-		// Restore our plug-in's state from the xml representation stored in the above
-		// method.
-		if (auto xmlState = getXmlFromBinary(data, sizeInBytes))
-			state.replaceState(ValueTree::fromXml(*xmlState));
+		clearVoices();
+		sampleRate = newRate;
 	}
 
-	//==============================================================================
-	void updateTrackProperties(const TrackProperties& properties) override
+	double getSampleRate() const noexcept { return sampleRate; }
+	int getNumActiveVoices() const noexcept { return numActive; }
+
+	void setRenderQuality(RenderQuality newQuality) noexcept { quality = newQuality; }
+	bool isHighQuality() const noexcept { return quality.hermiteInterpolation; }
+
+	//MIDIイベントの位置でブロックを分割しながらレンダリングする
+	template <typename FloatType>
+	void renderNextBlock(AudioBuffer<FloatType>& outputAudio, const MidiBuffer& midiData, int startSample, int numSamples)
 	{
+		auto endSample = startSample + numSamples;
+
+		for (const auto metadata : midiData)
 		{
-			const ScopedLock sl(trackPropertiesLock);
-			trackProperties = properties;
+			auto eventPos = jlimit(startSample, endSample, metadata.samplePosition);
+
+			renderVoices(outputAudio, startSample, eventPos - startSample);
+			handleMidiEvent(metadata.getMessage());
+			startSample = eventPos;
 		}
 
-		MessageManager::callAsync([this]
-			{
-				if (auto* editor = dynamic_cast<JuceDemoPluginAudioProcessorEditor*> (getActiveEditor()))
-					editor->updateTrackProperties();
-			});
+		renderVoices(outputAudio, startSample, endSample - startSample);
 	}
 
+	void noteOn(int midiChannel, int midiNoteNumber, float velocity)
+	{
+		if (sample == nullptr || sample->length == 0 || sampleRate <= 0)
+			return;
 
+		// 鳴っている同じ音はリリースさせてから新しいボイスを割り当てる(Synthesiserと同じ動作)
+		for (int v = 0; v < numActive; ++v)
+			if (note[v] == midiNoteNumber && channel[v] == midiChannel)
+				startRelease(v);
 
-	//synthsizer setup
-	void setupSampler(AudioFormatReader& newReader) {
-		isChanging = true;
-
-		synth.clearSounds();
-		synth.clearVoices();
-
-		BigInteger allNotes;
-		allNotes.setRange(0, 128, true);
+		int v = numActive < maxVoices ? numActive++ : findOldestVoice();
 
-		synth.addSound(new SamplerSound("default", newReader, allNotes, 60, 0, 0.1, 10.0));
+		note[v] = midiNoteNumber;
+		channel[v] = midiChannel;
+		order[v] = noteCounter++;
+		position[v] = 0.0;
+		pitchRatio[v] = std::pow(2.0, (midiNoteNumber - sample->midiRootNote) / 12.0) * sample->sourceSampleRate / sampleRate;
+		gain[v] = velocity;
 
-		for (int i = 0; i < 128; i++) {
-			synth.addVoice(new SamplerVoice());
+		if (sample->attackTime > 0.0)
+		{
+			envLevel[v] = 0.0f;
+			envDelta[v] = (float)(1.0 / (sample->attackTime * sample->sourceSampleRate));
+		}
+		else
+		{
+			envLevel[v] = 1.0f;
+			envDelta[v] = 0.0f;
 		}
 
-		isChanging = false;
+		releasing[v] = false;
 	}
 
-	void loadAudioFile() {
+	void noteOff(int midiChannel, int midiNoteNumber)
+	{
+		for (int v = 0; v < numActive; ++v)
+			if (note[v] == midiNoteNumber && channel[v] == midiChannel)
+				startRelease(v);
+	}
 
-		AudioFormatManager formatManager;
-		formatManager.registerBasicFormats();
+	void allNotesOff(bool allowTailOff)
+	{
+		if (!allowTailOff)
+		{
+			numActive = 0;
+			return;
+		}
 
-		MemoryInputStream* inputStream = new MemoryInputStream(BinaryData::piano_mp3, BinaryData::piano_mp3Size, true);
+		for (int v = 0; v < numActive; ++v)
+			startRelease(v);
+	}
 
-		AudioFormatReader* reader = formatManager.createReaderFor(inputStream);
+private:
+	void handleMidiEvent(const MidiMessage& m)
+	{
+		if (m.isNoteOn())
+			noteOn(m.getChannel(), m.getNoteNumber(), m.getFloatVelocity());
+		else if (m.isNoteOff())
+			noteOff(m.getChannel(), m.getNoteNumber());
+		else if (m.isAllNotesOff())
+			allNotesOff(true);
+		else if (m.isAllSoundOff())
+			allNotesOff(false);
+	}
 
-		if (reader != nullptr) {
-			setupSampler(*reader);
-			delete reader;
-		}
+	void startRelease(int v)
+	{
+		if (releasing[v])
+			return;
 
+		releasing[v] = true;
+		envDelta[v] = sample->releaseTime > 0.0 ? -(float)(envLevel[v] / (sample->releaseTime * sample->sourceSampleRate)) : -1.0f;
+	}
+
+	int findOldestVoice() const
+	{
+		int oldest = 0;
+
+		for (int v = 1; v < numActive; ++v)
+			if (order[v] < order[oldest])
+				oldest = v;
 
+		return oldest;
 	}
 
+	//鳴り終わったボイスを末尾と入れ替えて、アクティブなボイスを配列の先頭に詰めておく
+	void removeVoice(int v)
+	{
+		auto last = --numActive;
+
+		note[v] = note[last];
+		channel[v] = channel[last];
+		order[v] = order[last];
+		position[v] = position[last];
+		pitchRatio[v] = pitchRatio[last];
+		gain[v] = gain[last];
+		envLevel[v] = envLevel[last];
+		envDelta[v] = envDelta[last];
+		releasing[v] = releasing[last];
+	}
 
-	void loadSampleFile() {
-		AudioFormatManager formatManager;
-		formatManager.registerBasicFormats();
+	template <typename FloatType>
+	void renderVoices(AudioBuffer<FloatType>& outputAudio, int startSample, int numSamples)
+	{
+		while (numSamples > 0 && numActive > 0)
+		{
+			auto num = jmin(numSamples, quality.chunkSize);
+			auto* accL = accumulator.getWritePointer(0);
+			auto* accR = accumulator.getWritePointer(1);
+
+			FloatVectorOperations::clear(accL, num);
+			FloatVectorOperations::clear(accR, num);
+
+			for (int first = 0; first < numActive; first += laneWidth) {
+				if (quality.hermiteInterpolation)
+					mixGroup<true>(first, accL, accR, num);
+				else
+					mixGroup<false>(first, accL, accR, num);
+			}
 
-		FileChooser chooser("Open audio file to play.", File::nonexistent, formatManager.getWildcardForAllFormats());
+			for (int v = numActive; --v >= 0;)
+				if (position[v] > sample->length || (releasing[v] && envLevel[v] <= 0.0f))
+					removeVoice(v);
 
-		if (chooser.browseForFileToOpen()) {
-			File file(chooser.getResult());
-			AudioFormatReader* reader = formatManager.createReaderFor(file);
+			addToOutput(outputAudio, startSample, num);
+
+			startSample += num;
+			numSamples -= num;
+		}
+	}
+
+	//firstから始まるグループを処理する。ボイスは先頭に詰めてあるので空きのあるのは最後のグループだけで、
+	//そこは使っているボイスが収まる幅(8, 4, 2, 1)のレーンで処理し、空のレーンの分は計算しない
+	template <bool useHermite>
+	void mixGroup(int first, float* accL, float* accR, int num)
+	{
+		auto numUsed = numActive - first;
+
+		if (numUsed > laneWidth / 2)
+			mixLanes<useHermite, laneWidth>(first, accL, accR, num);
+		else if (numUsed > laneWidth / 4)
+			mixLanes<useHermite, laneWidth / 2>(first, accL, accR, num);
+		else if (numUsed > 1)
+			mixLanes<useHermite, laneWidth / 4>(first, accL, accR, num);
+		else
+			mixLanes<useHermite, 1>(first, accL, accR, num);
+	}
+
+	//numLanes個のボイスを1サンプルずつまとめて処理する。レーンの内側のループは
+	//固定長なのでコンパイラがSIMD命令(ギャザー付き)に展開できる。
+	//useHermiteなら4点のエルミート補間(サンプルの末尾の余白を使う)、そうでなければ直線補間
+	template <bool useHermite, int numLanes>
+	void mixLanes(int first, float* accL, float* accR, int num)
+	{
+		alignas(32) double pos[numLanes], ratio[numLanes];
+		alignas(32) float g[numLanes], env[numLanes], delta[numLanes];
+
+		for (int lane = 0; lane < numLanes; ++lane)
+		{
+			auto v = first + lane;
+			auto used = v < numActive;
+
+			pos[lane] = used ? position[v] : 0.0;
+			ratio[lane] = used ? pitchRatio[v] : 0.0;
+			g[lane] = used ? gain[v] : 0.0f;
+			env[lane] = used ? envLevel[v] : 0.0f;
+			delta[lane] = used ? envDelta[v] : 0.0f;
+		}
+
+		auto* inL = sample->data.getReadPointer(0);
+		auto* inR = sample->data.getNumChannels() > 1 ? sample->data.getReadPointer(1) : inL;
+		auto end = (double)sample->length;
+
+		for (int i = 0; i < num; ++i)
+		{
+			float sumL = 0.0f, sumR = 0.0f;
+
+			for (int lane = 0; lane < numLanes; ++lane)
+			{
+				auto p = jmin(pos[lane], end);
+				auto index = (int)p;
+				auto alpha = (float)(p - index);
+				auto live = pos[lane] <= end ? g[lane] : 0.0f;
+
+				env[lane] = jlimit(0.0f, 1.0f, env[lane] + delta[lane]);
 
-			if (reader != nullptr) {
-				setupSampler(*reader);
-				delete reader;
+				float l, r;
+
+				if (useHermite) {
+					auto before = jmax(0, index - 1);
+					l = hermite(inL[before], inL[index], inL[index + 1], inL[index + 2], alpha);
+					r = hermite(inR[before], inR[index], inR[index + 1], inR[index + 2], alpha);
+				}
+				else {
+					l = inL[index] + alpha * (inL[index + 1] - inL[index]);
+					r = inR[index] + alpha * (inR[index + 1] - inR[index]);
+				}
+
+				sumL += l * live * env[lane];
+				sumR += r * live * env[lane];
+				pos[lane] += ratio[lane];
 			}
+
+			accL[i] += sumL;
+			accR[i] += sumR;
 		}
 
+		for (int lane = 0; lane < numLanes && first + lane < numActive; ++lane)
+		{
+			auto v = first + lane;
+
+			position[v] = pos[lane];
+			envLevel[v] = env[lane];
 
+			if (envDelta[v] > 0.0f && envLevel[v] >= 1.0f)
+				envDelta[v] = 0.0f;
+		}
 	}
 
+	static float hermite(float y0, float y1, float y2, float y3, float x) noexcept
+	{
+		auto c1 = 0.5f * (y2 - y0);
+		auto c2 = y0 - 2.5f * y1 + 2.0f * y2 - 0.5f * y3;
+		auto c3 = 0.5f * (y3 - y0) + 1.5f * (y1 - y2);
 
+		return ((c3 * x + c2) * x + c1) * x + y1;
+	}
 
-	MidiKeyboardState& getMidiKeyboardState() {
-		return keyboardState;
+	void addToOutput(AudioBuffer<float>& outputAudio, int startSample, int num)
+	{
+		if (outputAudio.getNumChannels() > 1)
+		{
+			outputAudio.addFrom(0, startSample, accumulator, 0, 0, num);
+			outputAudio.addFrom(1, startSample, accumulator, 1, 0, num);
+		}
+		else if (outputAudio.getNumChannels() == 1)
+		{
+			outputAudio.addFrom(0, startSample, accumulator, 0, 0, num, 0.5f);
+			outputAudio.addFrom(0, startSample, accumulator, 1, 0, num, 0.5f);
+		}
 	}
 
+	void addToOutput(AudioBuffer<double>& outputAudio, int startSample, int num)
+	{
+		auto* accL = accumulator.getReadPointer(0);
+		auto* accR = accumulator.getReadPointer(1);
 
+		if (outputAudio.getNumChannels() > 1)
+		{
+			auto* outL = outputAudio.getWritePointer(0, startSample);
+			auto* outR = outputAudio.getWritePointer(1, startSample);
 
+			for (int i = 0; i < num; ++i)
+			{
+				outL[i] += accL[i];
+				outR[i] += accR[i];
+			}
+		}
+		else if (outputAudio.getNumChannels() == 1)
+		{
+			auto* out = outputAudio.getWritePointer(0, startSample);
 
-	TrackProperties getTrackProperties() const
+			for (int i = 0; i < num; ++i)
+				out[i] += (accL[i] + accR[i]) * 0.5;
+		}
+	}
+
+	SharedSample::Ptr sample;
+	AudioBuffer<float> accumulator;
+	double sampleRate = 0.0;
+	RenderQuality quality = getRealtimeQuality();
+
+	//ボイスごとの状態(先頭numActive個が発音中)
+	int numActive = 0;
+	uint32 noteCounter = 0;
+	int note[maxVoices], channel[maxVoices];
+	uint32 order[maxVoices];
+	double position[maxVoices], pitchRatio[maxVoices];
+	float gain[maxVoices], envLevel[maxVoices], envDelta[maxVoices];
+	bool releasing[maxVoices];
+
+	JUCE_DECLARE_NON_COPYABLE(SamplerVoiceBank)
+};
+
+//==============================================================================
+/** ホストのオートメーションを受けるパラメータ。
+	値はブロックの先頭でatomicを1回loadするだけで読み、変化があった位置(ブロック境界)から
+	rampLengthサンプルかけて直線で目標値へ近づける。ランプが終わる位置でブロックを分割すれば
+	残りは一定値として処理できる。 */
+class AutomatedParameter
+{
+public:
+	void attach(std::atomic<float>* newSource) { source = newSource; }
+
+	void prepare(double sampleRate, double rampSeconds)
 	{
-		const ScopedLock sl(trackPropertiesLock);
-		return trackProperties;
+		rampLength = jmax(1, roundToInt(sampleRate * rampSeconds));
+		current = target = source->load(std::memory_order_relaxed);
+		step = 0.0f;
+		remaining = 0;
 	}
 
-	class SpinLockedPosInfo
+	//ブロックの先頭で1回だけ呼ぶ
+	void beginBlock()
 	{
-	public:
-		SpinLockedPosInfo() { info.resetToDefault(); }
+		auto newTarget = source->load(std::memory_order_relaxed);
 
-		// Wait-free, but setting new info may fail if the main thread is currently
-		// calling `get`. This is unlikely to matter in practice because
-		// we'll be calling `set` much more frequently than `get`.
-		void set(const AudioPlayHead::CurrentPositionInfo& newInfo)
+		if (newTarget != target)
 		{
+			target = newTarget;
+			remaining = rampLength;
+			step = (target - current) / (float)rampLength;
+		}
+	}
 
-			const juce::SpinLock::ScopedTryLockType lock(mutex);
+	bool isRamping() const noexcept { return remaining > 0; }
+	int getRemainingRampSamples() const noexcept { return remaining; }
+	float getCurrentValue() const noexcept { return current; }
 
-			if (lock.isLocked())
-				info = newInfo;
+	//numSamples後の値(ランプの範囲内で使う)
+	float getValueAfter(int numSamples) const noexcept
+	{
+		return remaining > numSamples ? current + step * (float)numSamples : target;
+	}
 
-		}
+	void skip(int numSamples) noexcept
+	{
+		current = getValueAfter(numSamples);
+		remaining = jmax(0, remaining - numSamples);
+	}
 
-		AudioPlayHead::CurrentPositionInfo get() const noexcept
+private:
+	std::atomic<float>* source = nullptr;
+	float current = 0.0f, target = 0.0f, step = 0.0f;
+	int rampLength = 1, remaining = 0;
+};
+
+
+
+
+
+//==============================================================================
+/** 小節ごとにレンダリングした音声のキャッシュ(既定では使わない)。
+
+	同じ小節を繰り返すたびにボイスを合成し直さなくてすむよう、その小節で鳴らすノートを
+	残響が消えるまでレンダリングした音声を、(コード, 奏法, 残響の間に続く小節, キー, 音色, テンポ, 拍子, サンプルレート, サンプル)
+	ごとに持つ。続く小節も鍵に含めるのは、後の小節で同じ音が鳴り直すと前の音が切れるため。
+	残響を描く長さ(tailSeconds)にかかる小節はすべて鍵に入れ、その場で合成したときと同じところで音が切れるようにする。
+	入力が変われば鍵が変わるので古いものは使われなくなり、メモリの上限を超えた分は使われていない順に捨てる。
+
+	オーディオスレッドはtryGetで取り出して足し込むだけで、無ければrequestで頼み、その小節はその場で合成する。
+	レンダリングは専用のスレッドで行い、捨てた音声の解放もそのスレッドで行う。 */
+class BarRenderCache : private Thread
+{
+public:
+	static constexpr size_t defaultMemoryBudget = 128 * 1024 * 1024;
+	static constexpr double tailSeconds = 10.0; //小節の後に描く残響の上限
+	static constexpr int maxTailBars = 16;      //残響の間に続く小節の数の上限(これより速いテンポでは残響を短くする)
+
+	struct Key
+	{
+		int bars[1 + maxTailBars][3] = {}; //この小節と続く小節の(根音, コードの種類, 奏法)。使わない分は0
+		int numTailBars = 1;
+		int pitch = 0, tone = 0;
+		int timeSigNumerator = 4, timeSigDenominator = 4;
+		double bpm = 120.0, sampleRate = 44100.0;
+		const SharedSample* sample = nullptr;
+
+		bool operator== (const Key& other) const noexcept
 		{
-			const juce::SpinLock::ScopedLockType lock(mutex);
-			return info;
+			return std::memcmp(bars, other.bars, sizeof(bars)) == 0 && numTailBars == other.numTailBars
+				&& pitch == other.pitch && tone == other.tone
+				&& timeSigNumerator == other.timeSigNumerator && timeSigDenominator == other.timeSigDenominator
+				&& bpm == other.bpm && sampleRate == other.sampleRate && sample == other.sample;
 		}
+	};
 
+	struct Entry : public ReferenceCountedObject
+	{
+		using Ptr = ReferenceCountedObjectPtr<Entry>;
 
-	private:
-		juce::SpinLock mutex;
-		AudioPlayHead::CurrentPositionInfo info;
+		Key key;
+		AudioBuffer<float> audio;
+		int length = 0;    //残響を含めた長さ
+		int barLength = 0; //小節の長さ
+		uint32 lastUsed = 0;
 
+		size_t getNumBytes() const noexcept { return (size_t)audio.getNumChannels() * (size_t)audio.getNumSamples() * sizeof(float); }
+	};
 
+	//tailSecondsの残響にかかる小節の数
+	static int getNumTailBars(double bpm, int timeSigNumerator, int timeSigDenominator) noexcept
+	{
+		auto barSeconds = ChordStepEngine::getQuarterNotesPerBar(timeSigNumerator, timeSigDenominator) * 60.0 / bpm;
+		return jlimit(1, maxTailBars, (int)std::ceil(tailSeconds / barSeconds - 1.0e-6));
+	}
 
+	//keyの小節をsampleで鳴らした音声をentryに入れる。レンダリング用のスレッドから呼ばれる
+	using RenderFunction = std::function<void(const Key& key, SharedSample::Ptr sample, Entry& entry)>;
 
+	BarRenderCache(RenderFunction functionToUse, size_t memoryBudgetBytes)
+		: Thread("Bar render cache"), renderFunction(std::move(functionToUse)), memoryBudget(memoryBudgetBytes)
+	{
+		startThread(3);
+	}
 
-		//==============================================================================
-	};
+	~BarRenderCache() override
+	{
+		stopThread(4000);
+	}
 
+	void setMemoryBudget(size_t bytes) noexcept { memoryBudget = bytes; }
+	size_t getMemoryUsage() const noexcept { return memoryUsage; }
 
+	//サンプルを差し替えたら、それまでの音声はすべて使えない
+	void setSample(SharedSample::Ptr newSample)
+	{
+		const ScopedLock sl(lock);
 
+		if (newSample != sample) {
+			sample = newSample;
+			retireAll();
+		}
+	}
 
+	void clear()
+	{
+		const ScopedLock sl(lock);
+		retireAll();
+	}
 
-	//==============================================================================
-	// These properties are public so that our editor component can access them
-	// A bit of a hacky way to do it, but it's only a demo! Obviously in your own
-	// code you'll do this much more neatly..
-		//processblock skip
+	//オーディオスレッドから呼ぶ。ロックが取れないときは見つからなかったことにする
+	bool tryGet(const Key& key, Entry::Ptr& result)
+	{
+		const ScopedTryLock sl(lock);
 
-	bool isChanging;
+		if (!sl.isLocked())
+			return false;
 
-	// this is kept up to date with the midi messages that arrive, and the UI component
-	// registers with it so it can represent the incoming messages
-	MidiKeyboardState keyboardState;
+		for (auto* entry : entries) {
+			if (entry->key == key) {
+				entry->lastUsed = ++useCounter;
+				result = entry;
+				return true;
+			}
+		}
 
-	// this keeps a copy of the last set of time info that was acquired during an audio
-	// callback - the UI component will read this and display it.
-	AudioPlayHead::CurrentPositionInfo lastPosInfo;
+		return false;
+	}
 
-	// Our plug-in's current state
-	AudioProcessorValueTreeState state;
+	//オーディオスレッドから呼ぶ。いっぱいなら捨てる(次に同じ小節が来たときにまた頼む)
+	void request(const Key& key) noexcept
+	{
+		int start1, size1, start2, size2;
+		requests.prepareToWrite(1, start1, size1, start2, size2);
+
+		if (size1 > 0)
+			requestSlots[start1] = key;
+		else if (size2 > 0)
+			requestSlots[start2] = key;
 
+		requests.finishedWrite(size1 + size2);
+	}
 
 private:
-	//==============================================================================
-	/** This is the editor component that our filter will display. */
-	//GUI‚Ì•ÒW
-	class JuceDemoPluginAudioProcessorEditor : public AudioProcessorEditor,
-		private Timer,
-		private Value::Listener,
-		private Button::Listener
+	void run() override
 	{
-	public:
-		/*
-		jpop
-		rock
-		jazz
-		edm
-		idol
-		barade
-		anime
-		game
-		*/
-		//ジャンルごとに読み込まれるコードを設定
-		int Chord_g1[16][8][2] = { {{0,0},{7,0},{9,1},{4,1},{0,0},{7,0},{9,1},{7,0}},
-		{{5,0},{7,0},{9,1},{9,1},{5,0},{7,0},{9,1},{9,1} },
-		{ {0,0},{9,1},{5,0},{7,0},{0,0},{9,1},{5,0},{7,0} },
-		{ {9,1},{5,0},{0,0},{5,0},{9,1},{5,0},{0,0},{5,0} },
-		{ {2,3},{7,4},{0,2},{5,2},{11,2},{4,4},{7,1},{7,1} },
-		{ {5,0},{0,0},{5,0},{0,0},{5,0},{0,0},{5,0},{0,0} },
-		{ {5,0},{0,0},{9,1},{7,0},{5,0},{0,0},{9,1},{7,0} },
-		{ {9,1},{7,0},{5,0},{0,0},{9,1},{7,0},{5,0},{0,0}  },
-		{ {0,0},{9,1},{5,0},{7,0},{0,0},{9,1},{5,0},{7,0} },
-		{ {9,1},{2,1},{7,0},{9,1},{9,1},{2,1},{7,0},{9,1} },
-		{ {0,0},{7,0},{9,1},{7,0},{5,0},{0,0},{2,1},{7,0} },
-		{ {9,1},{7,0},{5,0},{0,0},{9,0},{7,0},{5,0},{0,0} },
-		{ {0,0},{5,0},{7,0},{0,0},{0,0},{5,0},{7,0},{0,0} },
-		{ {5,0},{7,0},{4,1},{9,1},{5,0},{7,0},{4,1},{9,1}},
-		{ {0,0},{5,0},{0,0},{7,0},{0,0},{5,0},{0,0},{7,0} },
-		{ {9,1},{5,0},{7,0},{4,0},{9,1},{5,0},{7,0},{4,0} } };
+		while (!threadShouldExit()) {
+			Key key;
 
+			if (!popRequest(key)) {
+				releaseRetiredEntries();
+				wait(20);
+				continue;
+			}
 
-	
-		
-		
-		int g_push[8] = { 0,0,0,0,0,0,0,0 };
+			SharedSample::Ptr sampleToUse;
 
-		const String Pattern_Name[5] = { "Normal","pop","wave","stylish","Jazz" };//奏法名の指定
+			{
+				const ScopedLock sl(lock);
 
-		int Page = 0;
-		const String Chord_Name[12] = { "C","C#","D" ,"D#" ,"E" ,"F" ,"F#" ,"G" ,"G#" ,"A" ,"A#" ,"B" }; //コード名の指定
-		const String Chord_Type[7] = { "","m","M7","m7","7","m(-5)","m7(-5)" }; //コード名(種類)の指定
+				if (contains(key) || sample.get() != key.sample)
+					continue;
 
-		//カラーコードでボタンの色指定
-		const Colour backg_1 = juce::Colour::fromRGB((uint8)119, (uint8)149, (uint8)198);//こいあお
-		const Colour backg_2 = juce::Colour::fromRGB((uint8)186, (uint8)204, (uint8)234);//うすいあお
-		const Colour backg_3 = juce::Colour::fromRGB((uint8)149, (uint8)202, (uint8)170);//こいみどり
-		const Colour backg_4 = juce::Colour::fromRGB((uint8)207, (uint8)227, (uint8)210);//うすいみどり
-		const Colour backg_5 = juce::Colour::fromRGB((uint8)204, (uint8)204, (uint8)204);//はいいろ
+				sampleToUse = sample;
+			}
 
+			if (sampleToUse == nullptr)
+				continue;
+
+			Entry::Ptr entry(new Entry());
+			entry->key = key;
+			renderFunction(key, sampleToUse, *entry);
+
+			if (entry->length <= 0)
+				continue;
+
+			const ScopedLock sl(lock);
+
+			if (sample.get() != key.sample || contains(key))
+				continue;
+
+			entry->lastUsed = ++useCounter;
+			entries.add(entry);
+			memoryUsage += entry->getNumBytes();
+
+			//上限を超えたら最も長く使っていないものから捨てる
+			while (memoryUsage > memoryBudget && entries.size() > 0) {
+				auto oldest = 0;
+
+				for (int i = 1; i < entries.size(); i++)
+					if (entries.getUnchecked(i)->lastUsed < entries.getUnchecked(oldest)->lastUsed)
+						oldest = i;
+
+				retire(oldest);
+			}
+		}
+	}
+
+	bool popRequest(Key& key) noexcept
+	{
+		int start1, size1, start2, size2;
+		requests.prepareToRead(1, start1, size1, start2, size2);
+
+		if (size1 > 0)
+			key = requestSlots[start1];
+		else if (size2 > 0)
+			key = requestSlots[start2];
+
+		requests.finishedRead(size1 + size2);
+		return size1 + size2 > 0;
+	}
+
+	bool contains(const Key& key) const
+	{
+		for (auto* entry : entries)
+			if (entry->key == key)
+				return true;
+
+		return false;
+	}
+
+	//再生中の音声はオーディオスレッドが参照を持っているので、retiredに移して参照がなくなるまで取っておく
+	void retire(int index)
+	{
+		memoryUsage -= entries.getUnchecked(index)->getNumBytes();
+		retired.add(entries.getUnchecked(index));
+		entries.remove(index);
+	}
+
+	void retireAll()
+	{
+		while (entries.size() > 0)
+			retire(entries.size() - 1);
+	}
+
+	void releaseRetiredEntries()
+	{
+		ReferenceCountedArray<Entry> unused;
 
-		//GUIの作成
-		JuceDemoPluginAudioProcessorEditor(JuceDemoPluginAudioProcessor& owner)
-			: AudioProcessorEditor(owner),
-			midiKeyboard(owner.keyboardState, MidiKeyboardComponent::horizontalKeyboard),
-			gainAttachment(owner.state, "gain", gainSlider),
-			delayAttachment(owner.state, "delay", delaySlider)
 		{
+			const ScopedLock sl(lock);
 
-			//Using Button Attach
-			addAndMakeVisible(Button_c1);
-			Button_c1.setButtonText(Chord_Name[Chord_Value[0 + Page][0]] + Chord_Type[Chord_Value[0 + Page][1]]);
-			Button_c1.setColour(juce::TextButton::buttonColourId, backg_4);
-			Button_c1.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
-			Button_c1.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
-			Button_c1.addListener(this);
-
-			addAndMakeVisible(Button_c2);
-			Button_c2.setButtonText(Chord_Name[Chord_Value[1 + Page][0]] + Chord_Type[Chord_Value[1 + Page][1]]);
-			Button_c2.setColour(juce::TextButton::buttonColourId, backg_4);
-			Button_c2.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
-			Button_c2.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
-			Button_c2.addListener(this);
-
-			addAndMakeVisible(Button_c3);
-			Button_c3.setButtonText(Chord_Name[Chord_Value[2 + Page][0]] + Chord_Type[Chord_Value[2 + Page][1]]);
-			Button_c3.setColour(juce::TextButton::buttonColourId, backg_4);
-			Button_c3.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
-			Button_c3.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
-			Button_c3.addListener(this);
-
-			addAndMakeVisible(Button_c4);
-			Button_c4.setButtonText(Chord_Name[Chord_Value[3 + Page][0]] + Chord_Type[Chord_Value[3 + Page][1]]);
-			Button_c4.setColour(juce::TextButton::buttonColourId, backg_4);
-			Button_c4.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
-			Button_c4.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
-			Button_c4.addListener(this);
-
-			addAndMakeVisible(Button_r1);
-			Button_r1.setButtonText("Normal");
-			Button_r1.setColour(juce::TextButton::buttonColourId, backg_4);
-			Button_r1.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
-			Button_r1.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
-			Button_r1.addListener(this);
-
-
-			addAndMakeVisible(Button_r2);
-			Button_r2.setButtonText("Normal");
-			Button_r2.setColour(juce::TextButton::buttonColourId, backg_4);
-			Button_r2.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
-			Button_r2.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
-			Button_r2.addListener(this);
-
-
-			addAndMakeVisible(Button_r3);
-			Button_r3.setButtonText("Normal");
-			Button_r3.setColour(juce::TextButton::buttonColourId, backg_4);
-			Button_r3.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
-			Button_r3.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
-			Button_r3.addListener(this);
-
-			addAndMakeVisible(Button_r4);
-			Button_r4.setButtonText("Normal");
-			Button_r4.setColour(juce::TextButton::buttonColourId, backg_4);
-			Button_r4.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
-			Button_r4.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
-			Button_r4.addListener(this);
+			for (int i = retired.size(); --i >= 0;) {
+				if (retired.getUnchecked(i)->getReferenceCount() == 1) {
+					unused.add(retired.getUnchecked(i));
+					retired.remove(i);
+				}
+			}
+		}
 
+		//ここで解放する(ロックの外)
+	}
 
-			addAndMakeVisible(Button_g1);
-			Button_g1.setButtonText("J-POP");
-			Button_g1.setColour(juce::TextButton::buttonColourId, backg_5);
-			Button_g1.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
-			Button_g1.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
-			Button_g1.addListener(this);
+	RenderFunction renderFunction;
+	std::atomic<size_t> memoryBudget, memoryUsage{ 0 };
 
-			addAndMakeVisible(Button_g2);
-			Button_g2.setButtonText("Rock");
-			Button_g2.setColour(juce::TextButton::buttonColourId, backg_5);
-			Button_g2.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
-			Button_g2.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
-			Button_g2.addListener(this);
+	CriticalSection lock;
+	ReferenceCountedArray<Entry> entries, retired;
+	SharedSample::Ptr sample;
+	uint32 useCounter = 0;
 
-			addAndMakeVisible(Button_g3);
-			Button_g3.setButtonText("Jazz");
-			Button_g3.setColour(juce::TextButton::buttonColourId, backg_5);
-			Button_g3.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
-			Button_g3.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
-			Button_g3.addListener(this);
+	static constexpr int maxRequests = 32;
+	AbstractFifo requests{ maxRequests };
+	Key requestSlots[maxRequests];
 
-			addAndMakeVisible(Button_g4);
-			Button_g4.setButtonText("EDM");
-			Button_g4.setColour(juce::TextButton::buttonColourId, backg_5);
-			Button_g4.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
-			Button_g4.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
-			Button_g4.addListener(this);
+	JUCE_DECLARE_NON_COPYABLE(BarRenderCache)
+};
+
+
+//==============================================================================
+/** オーディオスレッドからメッセージスレッドへ再生状態(位置、ステップ、発音数)の最新値を渡す。
+
+	3つのスロットを使うトリプルバッファで、push()は常に最新の状態で上書きするので、
+	エディタが長く読まなくても(閉じていても)pull()は最後に送られた状態を受け取る。
+	push()はオーディオスレッドだけ、pull()とgetLatest()はメッセージスレッドだけが呼ぶ。
+	どちらもロックもメモリ確保もしない。 */
+class AudioStatusChannel
+{
+public:
+	struct Status
+	{
+		AudioPlayHead::CurrentPositionInfo position;
+		int64 step = -1;	//再生位置のステップ(位置がわからないときは-1)
+		int numVoices = 0;
+
+		bool operator== (const Status& other) const noexcept
+		{
+			return step == other.step && numVoices == other.numVoices && position == other.position;
+		}
+
+		bool operator!= (const Status& other) const noexcept { return !operator== (other); }
+	};
+
+	AudioStatusChannel()
+	{
+		for (auto& slot : slots)
+			slot.position.resetToDefault();
+
+		lastPushed.position.resetToDefault();
+		latest.position.resetToDefault();
+	}
+
+	/** オーディオスレッドから。前回送った内容と同じなら何もしない */
+	void push(const Status& status) noexcept
+	{
+		if (status == lastPushed)
+			return;
+
+		//書き終えたスロットを中央と交換し、新しい値があることを印す
+		slots[writeIndex] = status;
+		writeIndex = middle.exchange(writeIndex | newDataFlag, std::memory_order_acq_rel) & indexMask;
+		lastPushed = status;
+	}
+
+	/** メッセージスレッドから。新しい状態が届いていれば受け取り、最新の状態が変わったらtrueを返す */
+	bool pull() noexcept
+	{
+		if ((middle.load(std::memory_order_relaxed) & newDataFlag) == 0)
+			return false;
+
+		readIndex = middle.exchange(readIndex, std::memory_order_acq_rel) & indexMask;
+
+		auto previous = latest;
+		latest = slots[readIndex];
+		return latest != previous;
+	}
+
+	/** メッセージスレッドから。最後にpull()で受け取った状態 */
+	const Status& getLatest() const noexcept { return latest; }
+
+private:
+	static constexpr int indexMask = 3, newDataFlag = 4;
+
+	Status slots[3];
+	int writeIndex = 0;				//オーディオスレッド側
+	std::atomic<int> middle{ 1 };	//受け渡し中のスロット(newDataFlagが立っていればまだ読まれていない)
+	int readIndex = 2;				//メッセージスレッド側
+
+	Status lastPushed;	//オーディオスレッド側
+	Status latest;		//メッセージスレッド側
+
+	JUCE_DECLARE_NON_COPYABLE(AudioStatusChannel)
+};
+
+
+//==============================================================================
+/** 128音ぶんの押鍵状態のビット列 */
+struct NoteBitmap
+{
+	uint64 words[2] = {};
+
+	void set(int note) noexcept    { words[note >> 6] |= (uint64)1 << (note & 63); }
+	void reset(int note) noexcept  { words[note >> 6] &= ~((uint64)1 << (note & 63)); }
+	bool test(int note) const noexcept { return ((words[note >> 6] >> (note & 63)) & 1) != 0; }
+	void clear() noexcept { words[0] = words[1] = 0; }
+
+	//MIDIメッセージのノートオン/オフを反映する
+	void apply(const MidiMessage& message) noexcept
+	{
+		if (message.isNoteOn())
+			set(message.getNoteNumber());
+		else if (message.isNoteOff())
+			reset(message.getNoteNumber());
+		else if (message.isAllNotesOff() || message.isAllSoundOff())
+			clear();
+	}
+
+	bool operator== (const NoteBitmap& other) const noexcept { return words[0] == other.words[0] && words[1] == other.words[1]; }
+	bool operator!= (const NoteBitmap& other) const noexcept { return !operator== (other); }
+};
+
+/** オーディオスレッドが毎ブロック書き、画面の鍵盤が読む押鍵状態。
+	2語を別々にatomicで書くので読み手が一瞬だけ新旧の混ざった状態を見ることはあるが、表示にしか使わない */
+class PublishedNoteBitmap
+{
+public:
+	void store(const NoteBitmap& bitmap) noexcept
+	{
+		words[0].store(bitmap.words[0], std::memory_order_relaxed);
+		words[1].store(bitmap.words[1], std::memory_order_relaxed);
+	}
+
+	NoteBitmap load() const noexcept
+	{
+		NoteBitmap bitmap;
+		bitmap.words[0] = words[0].load(std::memory_order_relaxed);
+		bitmap.words[1] = words[1].load(std::memory_order_relaxed);
+		return bitmap;
+	}
+
+private:
+	std::atomic<uint64> words[2] = {};
+};
+
+/** 画面の鍵盤で弾いたノートをメッセージスレッドからオーディオスレッドへ渡す単一生産者・単一消費者のキュー */
+class KeyboardEventQueue
+{
+public:
+	/** メッセージスレッドから。満杯なら捨てる */
+	void push(int note, float velocity, bool isNoteOn) noexcept
+	{
+		int start1, size1, start2, size2;
+		fifo.prepareToWrite(1, start1, size1, start2, size2);
+
+		if (size1 == 0)
+			return;
+
+		events[start1] = { (uint8)note, (uint8)jlimit(1, 127, roundToInt(velocity * 127.0f)), isNoteOn };
+		fifo.finishedWrite(1);
+	}
+
+	bool isEmpty() const noexcept { return fifo.getNumReady() == 0; }
+
+	/** オーディオスレッドから。届いているイベントをブロックの先頭に置く */
+	void popInto(MidiBuffer& midiMessages) noexcept
+	{
+		auto numReady = fifo.getNumReady();
+
+		if (numReady == 0)
+			return;
+
+		int start1, size1, start2, size2;
+		fifo.prepareToRead(numReady, start1, size1, start2, size2);
+
+		for (int i = 0; i < size1 + size2; i++) {
+			auto& e = events[i < size1 ? start1 + i : start2 + i - size1];
+			midiMessages.addEvent(e.isNoteOn ? MidiMessage::noteOn(1, e.note, e.velocity) : MidiMessage::noteOff(1, e.note), 0);
+		}
+
+		fifo.finishedRead(size1 + size2);
+	}
+
+private:
+	struct Event
+	{
+		uint8 note, velocity;
+		bool isNoteOn;
+	};
+
+	static constexpr int capacity = 256;
+	AbstractFifo fifo{ capacity };
+	Event events[capacity];
+};
+
+/** 自分のMidiKeyboardState(画面で弾いた分)に加えて、オーディオスレッドが公開した押鍵状態も押されているように描く鍵盤。
+	setSoundingNotes()では変わった鍵だけを再描画する */
+class NoteStateKeyboard : public MidiKeyboardComponent
+{
+public:
+	using MidiKeyboardComponent::MidiKeyboardComponent;
+
+	void setSoundingNotes(const NoteBitmap& notes)
+	{
+		if (notes == soundingNotes)
+			return;
+
+		for (int note = 0; note < 128; note++)
+			if (notes.test(note) != soundingNotes.test(note))
+				repaint(getRectangleForKey(note).getSmallestIntegerContainer());
+
+		soundingNotes = notes;
+	}
+
+protected:
+	void drawWhiteNote(int midiNoteNumber, Graphics& g, Rectangle<float> area, bool isDown, bool isOver, Colour lineColour, Colour textColour) override
+	{
+		MidiKeyboardComponent::drawWhiteNote(midiNoteNumber, g, area, isDown || soundingNotes.test(midiNoteNumber), isOver, lineColour, textColour);
+	}
+
+	void drawBlackNote(int midiNoteNumber, Graphics& g, Rectangle<float> area, bool isDown, bool isOver, Colour noteFillColour) override
+	{
+		MidiKeyboardComponent::drawBlackNote(midiNoteNumber, g, area, isDown || soundingNotes.test(midiNoteNumber), isOver, noteFillColour);
+	}
+
+private:
+	NoteBitmap soundingNotes;
+};
+
+
+//==============================================================================
+/** processBlockの実測値(ブロックの処理時間、出したイベント数、発音数、ピーク)を集める。
+
+	オーディオスレッドはpush()で固定長のリングに1件書くだけで、待つこともメモリ確保もしない
+	(満杯なら捨てて数だけ数える)。読み出しは収集スレッドだけが行い、一定間隔ごとの集計を
+	Summaryにまとめてエディタのメーターに渡し、ログファイルが指定されていれば1ブロック1行のCSVで書く。
+	ログのファイルを開く、書く、閉じるのも収集スレッドだけで、メッセージスレッドは開くファイルを頼むだけ。
+	収集スレッドはエディタが開いている間だけ動く(startCollecting()からstopCollecting()まで。
+	オフラインレンダリングのエンジンでは使わない)。 */
+class AudioTelemetry : private Thread
+{
+public:
+	struct Record
+	{
+		double seconds = 0;		//processBlockにかかった時間
+		double smoothedLoad = 0;	//AudioProcessLoadMeasurerの負荷(なまらせた値)
+		int numOverruns = 0;		//ブロックの長さを超えた回数(累計)
+		int numSamples = 0;
+		int numEvents = 0;
+		int numVoices = 0;
+		float peak = 0;
+	};
+
+	struct Summary
+	{
+		uint32 serial = 0;			//更新のたびに増える
+		int numBlocks = 0;
+		double averageLoad = 0, peakLoad = 0;	//ブロックの長さに対する処理時間の割合
+		double smoothedLoad = 0;
+		int numOverruns = 0;
+		double maxBlockMs = 0;
+		double eventsPerSecond = 0;
+		int maxVoices = 0, lastVoices = 0;
+		float peak = 0;
+		int64 numDropped = 0;
+	};
+
+	AudioTelemetry() : Thread("Audio telemetry") {}
+
+	~AudioTelemetry() override
+	{
+		stopThread(2000);
+	}
+
+	void startCollecting()
+	{
+		if (!isThreadRunning())
+			startThread(2);
+	}
+
+	/** 収集スレッドを止める。ログを書いていれば閉じる */
+	void stopCollecting()
+	{
+		stopThread(2000);
+	}
+
+	/** prepareToPlayから。負荷の計算に使う */
+	void setSampleRate(double newSampleRate) noexcept { sampleRate = newSampleRate; }
+
+	/** オーディオスレッドから。満杯なら捨てる */
+	void push(const Record& record) noexcept
+	{
+		int start1, size1, start2, size2;
+		ring.prepareToWrite(1, start1, size1, start2, size2);
+
+		if (size1 == 0) {
+			numDropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		records[start1] = record;
+		ring.finishedWrite(1);
+	}
+
+	/** メッセージスレッドから */
+	Summary getSummary() const
+	{
+		const ScopedLock sl(summaryLock);
+		return summary;
+	}
+
+	/** 集計をCSVでfileに書き出す。File()なら止める。ファイルは次の集計のときに収集スレッドが開く */
+	void setLogFile(const File& file)
+	{
+		const ScopedLock sl(requestLock);
+		requestedLogFile = file;
+		logFileRequested = true;
+	}
+
+	/** どのスレッドからでも。ロックを取らないのでpaintから呼んでよい */
+	bool isLogging() const noexcept { return logging.load(); }
+
+private:
+	static constexpr int capacity = 4096;
+	static constexpr int collectIntervalMs = 250;
+
+	void run() override
+	{
+		//止まっている間にたまった古い記録は集計しない
+		ring.finishedRead(ring.getNumReady());
+
+		auto intervalStart = Time::getMillisecondCounterHiRes();
+		Summary current;
+
+		while (!threadShouldExit())
+		{
+			wait(collectIntervalMs);
+
+			auto logChanged = updateLogStream();
+			auto numReady = ring.getNumReady();
+			int start1, size1, start2, size2;
+			ring.prepareToRead(numReady, start1, size1, start2, size2);
+
+			auto now = Time::getMillisecondCounterHiRes();
+
+			for (int i = 0; i < size1 + size2; i++)
+				add(current, records[i < size1 ? start1 + i : start2 + i - size1], now);
+
+			if (logStream != nullptr)
+				logStream->flush();
+
+			ring.finishedRead(size1 + size2);
+
+			//間隔ごとに集計を区切り、メーターに渡す
+			now = Time::getMillisecondCounterHiRes();
+
+			if (current.numBlocks > 0)
+			{
+				current.averageLoad /= current.numBlocks;
+				current.eventsPerSecond = current.eventsPerSecond * 1000.0 / jmax(1.0, now - intervalStart);
+			}
+
+			current.numDropped = numDropped.load(std::memory_order_relaxed);
+
+			{
+				//止まっている間は集計を更新しない(メーターも描き直さない)
+				const ScopedLock sl(summaryLock);
+
+				if (current.numBlocks > 0 || summary.numBlocks > 0 || current.numDropped != summary.numDropped || logChanged) {
+					current.serial = summary.serial + 1;
+					summary = current;
+				}
+			}
+
+			current = {};
+			intervalStart = now;
+		}
+
+		logStream.reset();
+		logging = false;
+	}
+
+	//頼まれたログファイルを開き直す(収集スレッドから)。開いたり閉じたりしたらtrue
+	bool updateLogStream()
+	{
+		File file;
+
+		{
+			const ScopedLock sl(requestLock);
+
+			if (!logFileRequested)
+				return false;
+
+			file = requestedLogFile;
+			logFileRequested = false;
+		}
+
+		logStream.reset();
+
+		if (file != File()) {
+			file.deleteFile();
+			logStream = std::make_unique<FileOutputStream>(file);
+
+			if (logStream->openedOk())
+				*logStream << "time_ms,block_ms,load,smoothed_load,overruns,samples,events,voices,peak\n";
+			else
+				logStream.reset();
+		}
+
+		logging = logStream != nullptr;
+		return true;
+	}
+
+	//収集スレッドから
+	void add(Summary& current, const Record& record, double now)
+	{
+		auto blockSeconds = sampleRate > 0 && record.numSamples > 0 ? record.numSamples / sampleRate : 0.0;
+		auto load = blockSeconds > 0 ? record.seconds / blockSeconds : 0.0;
+
+		current.numBlocks++;
+		current.averageLoad += load;
+		current.peakLoad = jmax(current.peakLoad, load);
+		current.maxBlockMs = jmax(current.maxBlockMs, record.seconds * 1000.0);
+		current.eventsPerSecond += record.numEvents;
+		current.maxVoices = jmax(current.maxVoices, record.numVoices);
+		current.lastVoices = record.numVoices;
+		current.peak = jmax(current.peak, record.peak);
+		current.smoothedLoad = record.smoothedLoad;
+		current.numOverruns = record.numOverruns;
+
+		if (logStream != nullptr)
+			*logStream << String(now, 1) << ',' << String(record.seconds * 1000.0, 4) << ',' << String(load, 4) << ','
+				<< String(record.smoothedLoad, 4) << ',' << record.numOverruns << ',' << record.numSamples << ',' << record.numEvents << ',' << record.numVoices << ',' << String(record.peak, 5) << "\n";
+	}
+
+	AbstractFifo ring{ capacity };
+	Record records[capacity];
+	std::atomic<int64> numDropped{ 0 };
+	std::atomic<double> sampleRate{ 44100.0 };
+
+	CriticalSection summaryLock;
+	Summary summary;
+
+	CriticalSection requestLock;	//requestedLogFileとlogFileRequestedだけを守る(入出力はしない)
+	File requestedLogFile;
+	bool logFileRequested = false;
+
+	std::unique_ptr<FileOutputStream> logStream;	//収集スレッドだけが触る
+	std::atomic<bool> logging{ false };
+
+	JUCE_DECLARE_NON_COPYABLE(AudioTelemetry)
+};
+
+
+//==============================================================================
+/** ホストのトランスポートが動いていないとき(スタンドアロンや停止中の試聴)に使う内部のトランスポート。
+
+	曲頭からの位置をサンプル数(整数)で数え、ppqはそこから計算するので、ホストに同期したときと
+	同じ規則でステップの境界がサンプル単位で決まり、長く鳴らしても誤差がたまらない。
+	テンポと拍子はメッセージスレッドから変えてよく、変えた位置から新しいテンポで進む。 */
+class InternalTransport
+{
+public:
+	static constexpr double minTempo = 20.0, maxTempo = 300.0;
+
+	void setTempo(double newBpm) noexcept { bpm = jlimit(minTempo, maxTempo, newBpm); }
+	double getTempo() const noexcept { return bpm; }
+
+	void setTimeSignature(int numerator, int denominator) noexcept
+	{
+		timeSigNumerator = jlimit(1, 32, numerator);
+		timeSigDenominator = isPowerOfTwo(denominator) ? jlimit(1, 32, denominator) : 4;
+	}
+
+	int getTimeSigNumerator() const noexcept { return timeSigNumerator; }
+	int getTimeSigDenominator() const noexcept { return timeSigDenominator; }
+
+	void prepare(double newSampleRate) noexcept
+	{
+		sampleRate = newSampleRate;
+		rewind();
+	}
+
+	//曲頭に戻す(オーディオスレッドから呼ぶ)
+	void rewind() noexcept
+	{
+		samplePosition = originSample = 0;
+		originPpq = 0.0;
+		segmentBpm = bpm;
+	}
+
+	//現在の位置をinfoに入れ、numSamplesだけ進める(オーディオスレッドから呼ぶ)
+	void getPositionAndAdvance(AudioPlayHead::CurrentPositionInfo& info, int numSamples) noexcept
+	{
+		//テンポが変わったら、そこまでのppqを起点にして数え直す
+		auto currentBpm = bpm.load();
+
+		if (currentBpm != segmentBpm) {
+			originPpq = getPpqAt(samplePosition);
+			originSample = samplePosition;
+			segmentBpm = currentBpm;
+		}
+
+		auto quarterNotesPerBar = ChordStepEngine::getQuarterNotesPerBar(timeSigNumerator, timeSigDenominator);
+
+		info.resetToDefault();
+		info.bpm = segmentBpm;
+		info.timeSigNumerator = timeSigNumerator;
+		info.timeSigDenominator = timeSigDenominator;
+		info.timeInSamples = samplePosition;
+		info.timeInSeconds = sampleRate > 0 ? (double)samplePosition / sampleRate : 0.0;
+		info.ppqPosition = getPpqAt(samplePosition);
+		info.ppqPositionOfLastBarStart = std::floor(info.ppqPosition / quarterNotesPerBar) * quarterNotesPerBar;
+		info.isPlaying = true;
+
+		samplePosition += numSamples;
+	}
+
+private:
+	double getPpqAt(int64 position) const noexcept
+	{
+		return sampleRate > 0 ? originPpq + (double)(position - originSample) * segmentBpm / (60.0 * sampleRate) : 0.0;
+	}
+
+	std::atomic<double> bpm{ 120.0 };
+	std::atomic<int> timeSigNumerator{ 4 }, timeSigDenominator{ 4 };
+
+	double sampleRate = 44100.0;
+	int64 samplePosition = 0, originSample = 0;
+	double originPpq = 0.0, segmentBpm = 120.0;
+};
+
+
+//==============================================================================
+/** ユーザーのプリセット(コード進行、奏法、キー、音色、サンプルの参照と、名前・ジャンル・タグ) */
+struct ProgressionPreset
+{
+	static constexpr int fileMagic = 0x50525043; // "CPRP"
+	static constexpr int fileVersion = 1;
+
+	String name, genre;
+	StringArray tags;
+	ChordProgression progression;
+	String samplePath; //空なら内蔵のピアノ
+
+	void write(OutputStream& out) const
+	{
+		out.writeInt(fileMagic);
+		out.writeInt(fileVersion);
+		out.writeString(name);
+		out.writeString(genre);
+		out.writeString(tags.joinIntoString(","));
+		out.writeString(samplePath);
+		progression.writeTo(out);
+	}
+
+	bool read(InputStream& in)
+	{
+		if (in.readInt() != fileMagic || in.readInt() < 1)
+			return false;
+
+		name = in.readString();
+		genre = in.readString();
+		tags = StringArray::fromTokens(in.readString(), ",", {});
+		samplePath = in.readString();
+		progression.readFrom(in);
+
+		return true;
+	}
+
+	bool save(const File& file) const
+	{
+		file.deleteFile();
+		FileOutputStream out(file);
+
+		if (!out.openedOk())
+			return false;
+
+		write(out);
+		return out.getStatus().wasOk();
+	}
+
+	bool load(const File& file)
+	{
+		FileInputStream in(file);
+		return in.openedOk() && read(in);
+	}
+};
+
+//==============================================================================
+/** ユーザーのプリセットのフォルダを索引付けして検索する。全インスタンスで1つを共有する。
+
+	索引(タグ、ジャンル、キー、使っているコード)はバックグラウンドのスレッドが作り、
+	ディスク上の索引ファイルに保存して次回はそれを読むだけで始める。フォルダは定期的に見直し、
+	更新日時と大きさが変わったプリセットだけを読み直す。
+	索引は作り終えるたびに変更しないスナップショットとして差し替えるので、
+	メッセージスレッドからの検索はロックを取らずにスナップショットを走査するだけで済む。 */
+class PresetDatabase : private Thread
+{
+public:
+	static constexpr const char* presetExtension = ".cprog";
+
+	struct Entry
+	{
+		File file;
+		int64 modificationTime = 0, size = 0;
+		ProgressionPreset preset;
+
+		String searchText;      //名前・ジャンル・タグを小文字にしてつなげたもの
+		uint64 chordMask[2] = {}; //使っているコード(音名×種類の84ビット)
+		int keyPitchClass = 0;
+
+		void updateSearchData()
+		{
+			searchText = (preset.name + " " + preset.genre + " " + preset.tags.joinIntoString(" ")).toLowerCase();
+			keyPitchClass = ((preset.progression.getPitch() % 12) + 12) % 12;
+			chordMask[0] = chordMask[1] = 0;
+
+			for (int i = 0; i < preset.progression.getNumBars(); i++) {
+				auto root = (preset.progression.getRoot(i) + keyPitchClass) % 12;
+				auto bit = root * ChordProgression::numChordTypes + preset.progression.getType(i);
+				chordMask[bit / 64] |= (uint64)1 << (bit % 64);
+			}
+		}
+	};
+
+	using Snapshot = std::vector<Entry>;
+
+	PresetDatabase()
+		: Thread("Preset indexer"), snapshot(std::make_shared<const Snapshot>())
+	{
+		startThread(2);
+	}
+
+	~PresetDatabase() override
+	{
+		stopThread(4000);
+	}
+
+	static File getPresetDirectory()
+	{
+		return File::getSpecialLocation(File::userApplicationDataDirectory)
+			.getChildFile("Chord Progressor").getChildFile("Presets");
+	}
+
+	//いまの索引(ロックを取らない)
+	std::shared_ptr<const Snapshot> getSnapshot() const
+	{
+		return std::atomic_load(&snapshot);
+	}
+
+	bool isIndexing() const noexcept { return indexing; }
+
+	//保存したら索引をすぐに作り直す
+	File savePreset(const ProgressionPreset& preset)
+	{
+		auto directory = getPresetDirectory();
+		directory.createDirectory();
+
+		auto file = directory.getNonexistentChildFile(File::createLegalFileName(preset.name.isNotEmpty() ? preset.name : "Preset"),
+			presetExtension, false);
+
+		if (!preset.save(file))
+			return {};
+
+		notify();
+		return file;
+	}
+
+	void rescan() { notify(); }
+
+	/** スペースで区切った語をすべて満たすプリセットを返す。
+		"Am7"のようなコード名はそのコードを使っているもの、"key:D"はキー、それ以外は名前・ジャンル・タグの部分一致 */
+	static std::vector<const Entry*> search(const Snapshot& entries, const String& query, int maxResults)
+	{
+		struct Term
+		{
+			String text;
+			int chordBit = -1, keyPitchClass = -1;
+		};
+
+		std::vector<Term> terms;
+
+		for (auto& token : StringArray::fromTokens(query, " ", "\""))
+		{
+			if (token.isEmpty())
+				continue;
+
+			Term term;
+
+			if (token.startsWithIgnoreCase("key:"))
+				term.keyPitchClass = parsePitchClass(token.substring(4));
+			else
+				term.chordBit = parseChord(token);
+
+			term.text = token.toLowerCase();
+			terms.push_back(term);
+		}
+
+		std::vector<const Entry*> results;
+
+		for (auto& entry : entries)
+		{
+			auto matches = true;
+
+			for (auto& term : terms)
+			{
+				if (term.keyPitchClass >= 0)
+					matches = entry.keyPitchClass == term.keyPitchClass;
+				else if (term.chordBit >= 0)
+					matches = (entry.chordMask[term.chordBit / 64] >> (term.chordBit % 64)) & 1;
+				else
+					matches = entry.searchText.contains(term.text);
+
+				if (!matches)
+					break;
+			}
+
+			if (matches) {
+				results.push_back(&entry);
+
+				if ((int)results.size() >= maxResults)
+					break;
+			}
+		}
+
+		return results;
+	}
+
+private:
+	static constexpr int indexMagic = 0x58495043; // "CPIX"
+	static constexpr int indexVersion = 1;
+	static constexpr int rescanIntervalMs = 10000;
+
+	static File getIndexFile()
+	{
+		return getPresetDirectory().getParentDirectory().getChildFile("PresetIndex.bin");
+	}
+
+	void run() override
+	{
+		//前回の索引を読めばすぐに検索できる
+		Snapshot entries;
+
+		if (loadIndex(entries))
+			publish(entries);
+
+		while (!threadShouldExit())
+		{
+			indexing = true;
+
+			if (updateIndex(entries)) {
+				publish(entries);
+				saveIndex(entries);
+			}
+
+			indexing = false;
+			wait(rescanIntervalMs);
+		}
+	}
+
+	//フォルダと索引を比べ、変わったものだけ読み直す。変化があればtrue
+	bool updateIndex(Snapshot& entries)
+	{
+		std::map<String, const Entry*> previous;
+
+		for (auto& entry : entries)
+			previous[entry.file.getFullPathName()] = &entry;
+
+		Snapshot updated;
+		updated.reserve(entries.size());
+		auto changed = false;
+
+		for (const auto& child : RangedDirectoryIterator(getPresetDirectory(), true, String("*") + presetExtension, File::findFiles))
+		{
+			if (threadShouldExit())
+				return false;
+
+			auto file = child.getFile();
+			auto modificationTime = child.getModificationTime().toMilliseconds();
+			auto size = child.getFileSize();
+			auto found = previous.find(file.getFullPathName());
+
+			if (found != previous.end() && found->second->modificationTime == modificationTime && found->second->size == size) {
+				updated.push_back(*found->second);
+				continue;
+			}
+
+			Entry entry;
+			entry.file = file;
+			entry.modificationTime = modificationTime;
+			entry.size = size;
+
+			if (entry.preset.load(file)) {
+				entry.updateSearchData();
+				updated.push_back(std::move(entry));
+			}
+
+			changed = true;
+		}
+
+		changed = changed || updated.size() != entries.size();
+
+		//名前順に並べておく
+		std::sort(updated.begin(), updated.end(), [](const Entry& a, const Entry& b)
+			{
+				return a.preset.name.compareNatural(b.preset.name) < 0;
+			});
+
+		entries = std::move(updated);
+		return changed;
+	}
+
+	void publish(const Snapshot& entries)
+	{
+		std::atomic_store(&snapshot, std::shared_ptr<const Snapshot>(std::make_shared<Snapshot>(entries)));
+	}
+
+	bool loadIndex(Snapshot& entries)
+	{
+		FileInputStream in(getIndexFile());
+
+		if (!in.openedOk() || in.readInt() != indexMagic || in.readInt() != indexVersion)
+			return false;
+
+		auto numEntries = in.readInt();
+
+		for (int i = 0; i < numEntries && !in.isExhausted(); i++)
+		{
+			Entry entry;
+			entry.file = getPresetDirectory().getChildFile(in.readString());
+			entry.modificationTime = in.readInt64();
+			entry.size = in.readInt64();
+
+			if (!entry.preset.read(in))
+				return false;
+
+			entry.updateSearchData();
+			entries.push_back(std::move(entry));
+		}
+
+		return true;
+	}
+
+	void saveIndex(const Snapshot& entries)
+	{
+		auto file = getIndexFile();
+		TemporaryFile temp(file);
+
+		{
+			FileOutputStream out(temp.getFile());
+
+			if (!out.openedOk())
+				return;
+
+			out.writeInt(indexMagic);
+			out.writeInt(indexVersion);
+			out.writeInt((int)entries.size());
+
+			for (auto& entry : entries)
+			{
+				out.writeString(entry.file.getRelativePathFrom(getPresetDirectory()));
+				out.writeInt64(entry.modificationTime);
+				out.writeInt64(entry.size);
+				entry.preset.write(out);
+			}
+
+			out.flush();
+
+			if (!out.getStatus().wasOk())
+				return;
+		}
+
+		temp.overwriteTargetFileWithTemporary();
+	}
+
+	static int parsePitchClass(const String& text)
+	{
+		const char* names = "C D EF G A B";
+		auto letter = text.substring(0, 1).toUpperCase();
+
+		if (letter.isEmpty() || letter[0] < 'A' || letter[0] > 'G')
+			return -1;
+
+		auto pitchClass = (int)(std::strchr(names, (char)letter[0]) - names);
+
+		if (text[1] == '#')
+			++pitchClass;
+		else if (text[1] == 'b')
+			--pitchClass;
+
+		return (pitchClass + 12) % 12;
+	}
+
+	//コード名(エディタと同じ表記)をマスクのビット番号にする。コード名でなければ-1
+	static int parseChord(const String& text)
+	{
+		static const char* const typeNames[ChordProgression::numChordTypes] = { "", "m", "M7", "m7", "7", "m(-5)", "m7(-5)" };
+
+		if (text.isEmpty() || text[0] < 'A' || text[0] > 'G')
+			return -1;
+
+		auto root = parsePitchClass(text);
+		auto suffix = text.substring((text[1] == '#' || text[1] == 'b') ? 2 : 1);
+
+		for (int type = 0; type < ChordProgression::numChordTypes; type++)
+			if (suffix == typeNames[type])
+				return root * ChordProgression::numChordTypes + type;
+
+		return -1;
+	}
+
+	std::shared_ptr<const Snapshot> snapshot;
+	std::atomic<bool> indexing{ false };
+
+	JUCE_DECLARE_NON_COPYABLE(PresetDatabase)
+};
+
+
+//==============================================================================
+/** ドラッグすると、createFileで作ったファイルをホストなどの外部へドロップできる小さなボタン */
+class FileDragSource : public Component
+{
+public:
+	FileDragSource(const String& labelText) : text(labelText)
+	{
+		setMouseCursor(MouseCursor::DraggingHandCursor);
+	}
+
+	std::function<File()> createFile;
+	Colour colour = Colours::lightgrey;
+
+	void paint(Graphics& g) override
+	{
+		g.setColour(colour);
+		g.fillRoundedRectangle(getLocalBounds().toFloat(), 4.0f);
+		g.setColour(Colours::black);
+		g.setFont(jmin(15.0f, getHeight() * 0.5f));
+		g.drawText(text, getLocalBounds(), Justification::centred);
+	}
+
+	void mouseDown(const MouseEvent&) override { dragStarted = false; }
+
+	void mouseDrag(const MouseEvent& e) override
+	{
+		if (dragStarted || createFile == nullptr || e.getDistanceFromDragStart() < 5)
+			return;
+
+		dragStarted = true;
+		auto file = createFile();
+
+		if (file.existsAsFile())
+			DragAndDropContainer::performExternalDragDropOfFiles({ file.getFullPathName() }, false, this);
+	}
+
+private:
+	String text;
+	bool dragStarted = false;
+};
+
+
+//==============================================================================
+/** 全小節のコード名(上段)と奏法(下段)を一つのコンポーネントで描く表。
+	小節数によらず子コンポーネントは持たず、クリックの判定も自前で行う。
+	refresh()は前回描いた内容と比べ、変わったセルだけを再描画する。
+*/
+class ProgressionGrid : public Component,
+	private Timer
+{
+public:
+	ProgressionGrid(const ChordProgression& p, const String* chordNames, const String* chordTypes, const String* patternNames)
+		: progression(p), rootNames(chordNames), typeNames(chordTypes), patternText(patternNames)
+	{
+		setOpaque(false);
+		drawnChord.fill(-1);
+		drawnPattern.fill(-1);
+		refresh();
+	}
+
+	/** 下段(奏法)のセルがクリックされたときに小節番号を渡して呼ばれる */
+	std::function<void(int bar)> onPatternClicked;
+
+	Colour cellColour = Colours::lightgrey;
+	Colour playheadColour = Colours::lightyellow;
+	float chordRowProportion = 0.6f;
+	float rowGapProportion = 0.15f;
+
+	//==============================================================================
+	void setVisibleBars(int numBars)
+	{
+		visibleBars = jmax(1, numBars);
+		scrollTarget = scrollPosition = clampScroll(scrollPosition);
+		repaint();
+	}
+
+	int getVisibleBars() const noexcept { return visibleBars; }
+
+	/** 表示の先頭をbarへ滑らかに動かす */
+	void scrollTo(double bar)
+	{
+		scrollTarget = clampScroll(bar);
+
+		if (scrollTarget != scrollPosition)
+			startTimerHz(60);
+	}
+
+	void scrollBy(double bars) { scrollTo(scrollTarget + bars); }
+
+	/** 表示の先頭をすぐにbarへ動かす */
+	void jumpTo(double bar)
+	{
+		stopTimer();
+		scrollTarget = scrollPosition = clampScroll(bar);
+		repaint();
+	}
+
+	double getScrollPosition() const noexcept { return scrollPosition; }
+
+	/** 再生中の小節とステップ(1小節stepsPerBarステップ)を示す。bar < 0 なら表示を消す。変わったセルだけ再描画する */
+	void setPlayhead(int bar, int step, int stepsPerBar)
+	{
+		if (bar == playheadBar && step == playheadStep && stepsPerBar == playheadStepsPerBar)
+			return;
+
+		if (bar != playheadBar) {
+			repaintBar(playheadBar);
+			repaintBar(bar);
+
+			//再生位置が表示範囲の外に出たら、その小節を含む頁へ送る
+			if (bar >= 0 && (bar < scrollTarget || bar >= scrollTarget + visibleBars))
+				scrollTo((bar / visibleBars) * visibleBars);
+		}
+		else {
+			repaint(getStepStripBounds(bar));
+		}
+
+		playheadBar = bar;
+		playheadStep = step;
+		playheadStepsPerBar = jmax(1, stepsPerBar);
+	}
+
+	/** コード進行と描画済みの内容を比べ、変わったセルだけ再描画する */
+	void refresh()
+	{
+		auto numBars = progression.getNumBars();
+
+		if (numBars != drawnNumBars) {
+			drawnNumBars = numBars;
+			scrollTarget = clampScroll(scrollTarget);
+			scrollPosition = clampScroll(scrollPosition);
+			repaint();
+		}
+
+		for (int bar = 0; bar < numBars; bar++) {
+			auto chord = getTransposedRoot(bar) * ChordProgression::numChordTypes + progression.getType(bar);
+			auto pattern = progression.getPattern(bar);
+
+			if (drawnChord[(size_t)bar] != chord) {
+				drawnChord[(size_t)bar] = (int8)chord;
+				repaint(getCellBounds(bar, false));
+			}
+
+			if (drawnPattern[(size_t)bar] != pattern) {
+				drawnPattern[(size_t)bar] = (int8)pattern;
+				repaint(getCellBounds(bar, true));
+			}
+		}
+	}
+
+	/** barの上段(patternRow=false)または下段のセルの位置。表示範囲外ならコンポーネントの外を指す */
+	Rectangle<int> getCellBounds(int bar, bool patternRow) const
+	{
+		auto rows = getRowBounds(patternRow);
+		auto width = getBarWidth();
+		auto x = (float)((bar - scrollPosition) * width);
+
+		return Rectangle<float>(x, (float)rows.getY(), (float)width, (float)rows.getHeight()).getSmallestIntegerContainer();
+	}
+
+	//==============================================================================
+	void paint(Graphics& g) override
+	{
+		auto clip = g.getClipBounds();
+		auto width = getBarWidth();
+		auto first = jmax(0, (int)std::floor(scrollPosition + clip.getX() / width));
+		auto last = jmin(progression.getNumBars() - 1, (int)std::floor(scrollPosition + clip.getRight() / width));
+
+		g.setFont(jmin(getRowBounds(false).getHeight() * 0.26f, getRowBounds(true).getHeight() * 0.6f));
+
+		for (int bar = first; bar <= last; bar++) {
+			paintCell(g, bar, false, rootNames[getTransposedRoot(bar)] + typeNames[progression.getType(bar)]);
+			paintCell(g, bar, true, patternText[progression.getPattern(bar)]);
+		}
+	}
+
+	void mouseDown(const MouseEvent& e) override
+	{
+		pressedBar = getBarAt(e.position);
+		pressedPattern = getRowBounds(true).contains(e.getPosition());
+
+		if (pressedBar >= 0)
+			repaint(getCellBounds(pressedBar, pressedPattern));
+	}
+
+	void mouseUp(const MouseEvent& e) override
+	{
+		auto bar = pressedBar;
+		auto wasPattern = pressedPattern;
+
+		pressedBar = -1;
+
+		if (bar < 0)
+			return;
+
+		repaint(getCellBounds(bar, wasPattern));
+
+		if (wasPattern && getBarAt(e.position) == bar && getRowBounds(true).contains(e.getPosition()) && onPatternClicked != nullptr)
+			onPatternClicked(bar);
+	}
+
+	void mouseWheelMove(const MouseEvent&, const MouseWheelDetails& wheel) override
+	{
+		auto delta = std::abs(wheel.deltaX) > std::abs(wheel.deltaY) ? -wheel.deltaX : -wheel.deltaY;
+		jumpTo(scrollPosition + delta * visibleBars);
+	}
+
+private:
+	double getBarWidth() const noexcept { return getWidth() / (double)visibleBars; }
+
+	Rectangle<int> getRowBounds(bool patternRow) const
+	{
+		auto area = getLocalBounds();
+		auto chordRow = area.removeFromTop(roundToInt(getHeight() * chordRowProportion));
+		area.removeFromTop(roundToInt(getHeight() * rowGapProportion));
+
+		return patternRow ? area : chordRow;
+	}
+
+	int getBarAt(Point<float> position) const
+	{
+		if (!getRowBounds(false).contains(position.toInt()) && !getRowBounds(true).contains(position.toInt()))
+			return -1;
+
+		auto bar = (int)std::floor(scrollPosition + position.x / getBarWidth());
+		return isPositiveAndBelow(bar, progression.getNumBars()) ? bar : -1;
+	}
+
+	int getTransposedRoot(int bar) const noexcept
+	{
+		return ((progression.getRoot(bar) + progression.getPitch()) % 12 + 12) % 12;
+	}
+
+	void paintCell(Graphics& g, int bar, bool patternRow, const String& text)
+	{
+		auto cell = getCellBounds(bar, patternRow).toFloat().reduced(1.0f);
+		auto isDown = bar == pressedBar && patternRow == pressedPattern;
+		auto isPlaying = bar == playheadBar;
+
+		g.setColour(isDown ? cellColour.darker(0.2f) : (isPlaying ? playheadColour : cellColour));
+		g.fillRoundedRectangle(cell, 4.0f);
+		g.setColour(isPlaying ? Colours::black.withAlpha(0.6f) : Colours::black.withAlpha(0.25f));
+		g.drawRoundedRectangle(cell, 4.0f, isPlaying ? 2.0f : 1.0f);
+		g.setColour(Colours::black);
+		g.drawText(text, cell, Justification::centred);
+
+		//再生中の小節は上段の下端に16分のステップ(拍子で数が変わる)を並べ、鳴っているステップを塗る
+		if (isPlaying && !patternRow) {
+			auto strip = getStepStripBounds(bar).toFloat();
+			auto slotWidth = strip.getWidth() / (float)playheadStepsPerBar;
+
+			for (int i = 0; i < playheadStepsPerBar; i++) {
+				auto slot = strip.withX(strip.getX() + slotWidth * (float)i).withWidth(slotWidth).reduced(1.0f, 0.0f);
+				g.setColour(i == playheadStep ? Colours::black.withAlpha(0.7f) : Colours::black.withAlpha(i % 4 == 0 ? 0.2f : 0.1f));
+				g.fillRect(slot);
+			}
+		}
+	}
+
+	void repaintBar(int bar)
+	{
+		if (bar >= 0) {
+			repaint(getCellBounds(bar, false));
+			repaint(getCellBounds(bar, true));
+		}
+	}
+
+	Rectangle<int> getStepStripBounds(int bar) const
+	{
+		return getCellBounds(bar, false).reduced(6, 0).removeFromBottom(6).translated(0, -4);
+	}
+
+	double clampScroll(double bar) const
+	{
+		return jlimit(0.0, (double)jmax(0, progression.getNumBars() - visibleBars), bar);
+	}
+
+	void timerCallback() override
+	{
+		//目標との差を毎フレーム3割ずつ詰める
+		auto next = scrollPosition + (scrollTarget - scrollPosition) * 0.3;
+
+		if (std::abs(scrollTarget - next) < 0.01) {
+			next = scrollTarget;
+			stopTimer();
+		}
+
+		scrollPosition = next;
+		repaint();
+	}
+
+	const ChordProgression& progression;
+	const String* rootNames;
+	const String* typeNames;
+	const String* patternText;
+
+	int visibleBars = 4;
+	double scrollPosition = 0, scrollTarget = 0;
+	int drawnNumBars = 0;
+	std::array<int8, ChordProgression::maxBars> drawnChord, drawnPattern;
+	int pressedBar = -1;
+	bool pressedPattern = false;
+
+	int playheadBar = -1, playheadStep = -1, playheadStepsPerBar = 16;
+
+	JUCE_DECLARE_NON_COPYABLE(ProgressionGrid)
+};
+
+
+//==============================================================================
+/** コード進行の全小節でステップエンジンが鳴らすノートを並べるピアノロール。
+
+	ノートは小節ごとに保持画像(1小節 = 16ステップ×pixelsPerStep、1音 = rowHeight)へ描いておき、
+	refresh()では内容の変わった小節の列だけを描き直す。スクロールと拡大縮小は
+	保持画像を変換して転送するだけなので、長い進行でも描画の重さは画面の大きさだけで決まる。 */
+class PianoRollView : public Component
+{
+public:
+	PianoRollView(const ChordProgression& p)
+		: progression(p),
+		  rollImage(Image::ARGB, ChordProgression::maxBars * barImageWidth(), 128 * rowHeight, true)
+	{
+		renderedKeys.fill(0);
+		refresh();
+	}
+
+	Colour backgroundColour = Colours::white.withAlpha(0.6f);
+
+	/** 拍子の分子。ステップの数え方をエンジンと揃えるのに使う */
+	void setTimeSigNumerator(int newNumerator)
+	{
+		if (newNumerator != numerator) {
+			numerator = newNumerator;
+			refresh();
+		}
+	}
+
+	/** 内容の変わった小節だけを保持画像に描き直す */
+	void refresh()
+	{
+		auto numBars = progression.getNumBars();
+		auto changed = numBars != drawnNumBars;
+
+		for (int bar = 0; bar < numBars; bar++) {
+			auto key = getBarKey(bar);
+
+			if (renderedKeys[(size_t)bar] != key) {
+				renderedKeys[(size_t)bar] = key;
+				renderBar(bar);
+				changed = true;
+			}
+		}
+
+		if (!changed)
+			return;
+
+		drawnNumBars = numBars;
+
+		//表示する音域は、いま鳴るノートの最低音から最高音まで(最低1オクターブ)
+		auto low = 127, high = 0;
+
+		for (int bar = 0; bar < numBars; bar++) {
+			low = jmin(low, (int)barLowNote[(size_t)bar]);
+			high = jmax(high, (int)barHighNote[(size_t)bar]);
+		}
+
+		if (low > high)
+			low = 48, high = 72;
+
+		auto centre = (low + high) / 2;
+		lowNote = jlimit(0, 127, jmin(low - 1, centre - 6));
+		highNote = jlimit(0, 127, jmax(high + 1, centre + 6));
+
+		setVisibleBars(visibleBars);
+		repaint();
+	}
+
+	/** 画面に収める小節数(拡大縮小) */
+	void setVisibleBars(double numBars)
+	{
+		visibleBars = jlimit(1.0, (double)jmax(1, progression.getNumBars()), numBars);
+		setScrollPosition(scrollPosition);
+	}
+
+	void setScrollPosition(double bar)
+	{
+		auto newPosition = jlimit(0.0, jmax(0.0, progression.getNumBars() - visibleBars), bar);
+
+		if (newPosition != scrollPosition) {
+			scrollPosition = newPosition;
+			repaint();
+		}
+	}
+
+	/** 再生中の小節と小節内の位置(0〜stepsPerBar-1、奏法の16ステップで折り返さない値)。
+		bar < 0 なら表示しない。線の前後だけを再描画する */
+	void setPlayhead(int bar, int step, int stepsPerBar)
+	{
+		stepsPerBar = jmax(1, stepsPerBar);
+		auto position = bar < 0 ? -1.0 : bar + jlimit(0, stepsPerBar - 1, step) / (double)stepsPerBar;
+
+		if (position == playheadPosition)
+			return;
+
+		repaint(getPlayheadBounds(playheadPosition));
+		playheadPosition = position;
+		repaint(getPlayheadBounds(playheadPosition));
+	}
+
+	//==============================================================================
+	void paint(Graphics& g) override
+	{
+		g.setColour(backgroundColour);
+		g.fillRect(getLocalBounds());
+
+		auto barWidth = getWidth() / visibleBars;
+		auto rowScale = getHeight() / (double)((highNote - lowNote + 1) * rowHeight);
+		auto visibleWidth = (int)std::ceil(jmin((double)progression.getNumBars(), scrollPosition + visibleBars) * barImageWidth());
+
+		//保持画像のうち、進行の長さまでを今の拡大率と位置で転送する
+		g.saveState();
+		g.reduceClipRegion(Rectangle<double>(0.0, 0.0, (progression.getNumBars() - scrollPosition) * barWidth, (double)getHeight()).getSmallestIntegerContainer());
+		g.setImageResamplingQuality(Graphics::lowResamplingQuality);
+		g.drawImageTransformed(rollImage.getClippedImage({ 0, 0, visibleWidth, rollImage.getHeight() }),
+			AffineTransform::translation((float)(-scrollPosition * barImageWidth()), (float)(-(127 - highNote) * rowHeight))
+				.scaled((float)(barWidth / barImageWidth()), (float)rowScale));
+		g.restoreState();
+
+		//小節線
+		g.setColour(Colours::black.withAlpha(0.3f));
+
+		for (auto bar = (int)std::ceil(scrollPosition); bar <= jmin(progression.getNumBars(), (int)(scrollPosition + visibleBars) + 1); bar++)
+			g.drawVerticalLine(roundToInt((bar - scrollPosition) * barWidth), 0.0f, (float)getHeight());
+
+		if (playheadPosition >= 0) {
+			g.setColour(Colours::red.withAlpha(0.8f));
+			g.fillRect(getPlayheadBounds(playheadPosition).reduced(1, 0));
+		}
+	}
+
+	//ホイールで左右に送り、Ctrl(Command)を押しながらなら拡大縮小する
+	void mouseWheelMove(const MouseEvent& e, const MouseWheelDetails& wheel) override
+	{
+		auto delta = std::abs(wheel.deltaX) > std::abs(wheel.deltaY) ? -wheel.deltaX : -wheel.deltaY;
+
+		if (e.mods.isCommandDown()) {
+			//マウスの下の位置を動かさずに拡大縮小する
+			auto anchor = scrollPosition + e.position.x / getWidth() * visibleBars;
+			setVisibleBars(visibleBars * std::pow(2.0, (double)-wheel.deltaY));
+			setScrollPosition(anchor - e.position.x / getWidth() * visibleBars);
+		}
+		else {
+			setScrollPosition(scrollPosition + delta * visibleBars);
+		}
+	}
+
+	void mouseDown(const MouseEvent&) override { dragStartPosition = scrollPosition; }
+
+	void mouseDrag(const MouseEvent& e) override
+	{
+		setScrollPosition(dragStartPosition - e.getDistanceFromDragStartX() / (double)getWidth() * visibleBars);
+	}
+
+private:
+	static constexpr int stepsPerBarImage = 16, pixelsPerStep = 4, rowHeight = 2;
+
+	static int barImageWidth() noexcept { return stepsPerBarImage * pixelsPerStep; }
+
+	uint32 getBarKey(int bar) const noexcept
+	{
+		//0は未描画を表すので、必ず最上位ビットを立てる
+		return 0x80000000u
+			| (uint32)(progression.getRoot(bar) + 12) << 20 | (uint32)progression.getType(bar) << 16
+			| (uint32)progression.getPattern(bar) << 12 | (uint32)(progression.getPitch() + 12) << 6 | (uint32)jlimit(0, 63, numerator);
+	}
+
+	/** barの列を消し、ステップエンジンが鳴らすノートを描き直す。
+		ノートは次に鍵盤がリセットされるか、同じ音が打ち直されるか、小節の終わりまで伸ばす */
+	void renderBar(int bar)
+	{
+		auto column = Rectangle<int>(bar * barImageWidth(), 0, barImageWidth(), rollImage.getHeight());
+		rollImage.clear(column);
+
+		Graphics g(rollImage);
+		g.reduceClipRegion(column);
+
+		g.setColour(Colours::black.withAlpha(bar % 2 == 0 ? 0.04f : 0.08f));
+		g.fillRect(column);
+
+		auto stepsPerBar = ChordStepEngine::getStepsPerBar(numerator);
+		auto stepWidth = barImageWidth() / (float)stepsPerBar;
+		int startStep[128];
+		std::fill(std::begin(startStep), std::end(startStep), -1);
+
+		auto low = 127, high = 0;
+
+		auto drawNote = [&](int note, int endStep) {
+			auto x = (float)column.getX() + startStep[note] * stepWidth;
+			g.setColour(Colour::fromHSV((float)(note % 12) / 12.0f, 0.55f, 0.8f, 1.0f));
+			g.fillRect(Rectangle<float>(x, (float)((127 - note) * rowHeight), jmax(1.0f, (endStep - startStep[note]) * stepWidth - 1.0f), (float)rowHeight));
+			startStep[note] = -1;
+			low = jmin(low, note);
+			high = jmax(high, note);
+		};
+
+		ChordStepEngine::Cursor cursor;
+
+		for (int i = 0; i < stepsPerBar; i++) {
+			ChordStep step;
+
+			if (!cursor.advance(progression, (int64)bar * stepsPerBar + i, numerator, step))
+				continue;
+
+			if (step.clearsKeyboard)
+				for (int note = 0; note < 128; note++)
+					if (startStep[note] >= 0)
+						drawNote(note, i);
+
+			for (int n = 0; n < step.numNotes; n++) {
+				auto note = step.notes[n];
+
+				if (!isPositiveAndBelow(note, 128))
+					continue;
+
+				if (startStep[note] >= 0 && startStep[note] < i)
+					drawNote(note, i);
+
+				if (startStep[note] < 0)
+					startStep[note] = i;
+			}
+		}
+
+		for (int note = 0; note < 128; note++)
+			if (startStep[note] >= 0)
+				drawNote(note, stepsPerBar);
+
+		barLowNote[(size_t)bar] = (uint8)low;
+		barHighNote[(size_t)bar] = (uint8)high;
+	}
+
+	Rectangle<int> getPlayheadBounds(double position) const
+	{
+		if (position < 0)
+			return {};
+
+		auto x = (position - scrollPosition) * getWidth() / visibleBars;
+		return Rectangle<int>(roundToInt(x) - 2, 0, 4, getHeight());
+	}
+
+	const ChordProgression& progression;
+	Image rollImage;
+	std::array<uint32, ChordProgression::maxBars> renderedKeys;
+	std::array<uint8, ChordProgression::maxBars> barLowNote, barHighNote;
+
+	int numerator = 4;
+	int drawnNumBars = 0;
+	int lowNote = 48, highNote = 72;
+	double visibleBars = 8, scrollPosition = 0, dragStartPosition = 0;
+	double playheadPosition = -1;
+
+	JUCE_DECLARE_NON_COPYABLE(PianoRollView)
+};
+
+
+//==============================================================================
+/** AudioTelemetryの集計を1行で表示するメーター。右クリックでCSVへの記録を始める/止める */
+class TelemetryMeter : public Component
+{
+public:
+	TelemetryMeter(AudioTelemetry& t) : telemetry(t) {}
+
+	void update()
+	{
+		auto latest = telemetry.getSummary();
+
+		if (latest.serial != summary.serial) {
+			summary = latest;
+			repaint();
+		}
+	}
+
+	void paint(Graphics& g) override
+	{
+		auto area = getLocalBounds().toFloat();
+		auto loadArea = area.removeFromLeft(area.getWidth() * 0.2f).reduced(2.0f, 3.0f);
+
+		//負荷(AudioProcessLoadMeasurer)を棒で、区間内で最も重かったブロックを線で示す
+		g.setColour(Colours::black.withAlpha(0.15f));
+		g.fillRect(loadArea);
+		g.setColour(summary.peakLoad > 0.8 ? Colours::red : Colour::fromRGB(119, 149, 198));
+		g.fillRect(loadArea.withWidth(loadArea.getWidth() * (float)jmin(1.0, summary.smoothedLoad)));
+		g.setColour(Colours::black);
+		g.fillRect(Rectangle<float>(loadArea.getX() + loadArea.getWidth() * (float)jmin(1.0, summary.peakLoad), loadArea.getY(), 1.5f, loadArea.getHeight()));
+
+		String text;
+		text << "CPU " << String(summary.smoothedLoad * 100.0, 1) << "% (peak " << String(summary.peakLoad * 100.0, 1) << "%, "
+			<< String(summary.maxBlockMs, 2) << " ms, " << summary.numOverruns << " overruns)  Voices " << summary.lastVoices << " (max " << summary.maxVoices << ")  Events "
+			<< String(summary.eventsPerSecond, 0) << "/s  Peak " << String(Decibels::gainToDecibels(summary.peak), 1) << " dB";
+
+		if (summary.numDropped > 0)
+			text << "  Dropped " << String(summary.numDropped);
+
+		if (telemetry.isLogging())
+			text << "  [logging]";
+
+		if (showPaintTiming)
+			text << "  " << paintTimingText;
+
+		g.setFont(jmin(13.0f, getHeight() * 0.8f));
+		g.drawText(text, area.reduced(6.0f, 0.0f), Justification::centredLeft, true);
+	}
+
+	void mouseDown(const MouseEvent& e) override
+	{
+		if (!e.mods.isPopupMenu())
+			return;
+
+		PopupMenu menu;
+		menu.addItem(1, "Log telemetry to CSV", !telemetry.isLogging());
+		menu.addItem(2, "Stop logging", telemetry.isLogging());
+		menu.addItem(3, "Show paint timing", true, showPaintTiming);
+
+		SafePointer<TelemetryMeter> safeThis(this);
+		menu.showMenuAsync(PopupMenu::Options().withTargetComponent(this), [safeThis](int result)
+		{
+			if (safeThis == nullptr || result == 0)
+				return;
+
+			if (result == 1) {
+				auto folder = File::getSpecialLocation(File::userDocumentsDirectory).getChildFile("Chord Progressor");
+				folder.createDirectory();
+				safeThis->telemetry.setLogFile(folder.getNonexistentChildFile("telemetry", ".csv", false));
+			}
+			else if (result == 2) {
+				safeThis->telemetry.setLogFile({});
+			}
+			else {
+				safeThis->showPaintTiming = !safeThis->showPaintTiming;
+			}
+
+			safeThis->repaint();
+		});
+	}
+
+	//エディタの背景の描画時間(作り直しとキャッシュの転送)。メニューでオンにしたときだけ表示する
+	void setPaintTimingText(const String& text)
+	{
+		if (text == paintTimingText)
+			return;
+
+		paintTimingText = text;
+
+		if (showPaintTiming)
+			repaint();
+	}
+
+private:
+	AudioTelemetry& telemetry;
+	AudioTelemetry::Summary summary;
+	String paintTimingText;
+	bool showPaintTiming = false;
+};
+
+
+//==============================================================================
+/** オーディオコールバック中に実時間処理で使ってはいけない操作(メモリ確保、ミューテックス、ファイル入出力)を見張る。
+
+	processBlockはScopedAudioCallbackで自分のスレッドを登録し、Main.cppのフック(operator new/delete、
+	LinuxではmallocやPOSIX関数の差し替え)がcheck()を呼ぶ。登録中のスレッドからの呼び出しは違反として数え、
+	abortOnViolationなら止める。フックから呼ばれるので、ここではメモリ確保もロックもスレッドローカル変数も使わない。
+	CHORDP_RT_SAFETY_HOOKSが0のビルド(検査を無効にしたか、プラグインの形式を含むビルド)ではフックがなく、何も検出しない。 */
+class RealtimeSafetyChecker
+{
+public:
+	enum class Mode { report, abortOnViolation };
+
+	static void setMode(Mode newMode) noexcept { getState().abortOnViolation = newMode == Mode::abortOnViolation; }
+
+	struct ScopedAudioCallback
+	{
+		ScopedAudioCallback() noexcept : slot(enter()) {}
+		~ScopedAudioCallback() noexcept { leave(slot); }
+
+		const int slot;
+	};
+
+	/** フックから呼ぶ。今のスレッドがオーディオコールバック中なら違反にする */
+	static void check(const char* operation) noexcept
+	{
+		auto& state = getState();
+		auto thread = Thread::getCurrentThreadId();
+
+		for (int i = 0; i < maxThreads; ++i)
+			if (state.threads[i].load(std::memory_order_relaxed) == thread)
+				return reportViolation(i, operation);
+	}
+
+	static int getNumViolations() noexcept { return getState().numViolations.load(); }
+
+	static String getFirstViolation()
+	{
+		auto& state = getState();
+		return state.hasFirstViolation.load() ? String(state.firstViolation) : String();
+	}
+
+	static void resetViolations() noexcept
+	{
+		auto& state = getState();
+		state.numViolations = 0;
+		state.hasFirstViolation = false;
+	}
+
+	/** 画面なしで内蔵エンジンを実時間の設定で鳴らし、違反の数を返す(検査を組み込んでいないビルドでは-1)。
+		テストのハーネスなど、メッセージスレッドの役をするスレッドから呼ぶ */
+	static int runHeadlessCheck(int numBlocks = 4000, int blockSize = 256, double sampleRate = 44100.0);
+
+private:
+	static constexpr int maxThreads = 64;
+	static constexpr int maxDescriptionLength = 128;
+
+	//静的な領域に置き(動的な初期化なし)、フックからいつ呼ばれても使えるようにする
+	struct State
+	{
+		std::atomic<Thread::ThreadID> threads[maxThreads];
+		std::atomic<int> numViolations;
+		std::atomic<bool> abortOnViolation, hasFirstViolation;
+		char firstViolation[maxDescriptionLength];
+	};
+
+	static State& getState() noexcept
+	{
+		static State state;
+		return state;
+	}
+
+	static int enter() noexcept
+	{
+		auto& state = getState();
+		auto thread = Thread::getCurrentThreadId();
+
+		for (int i = 0; i < maxThreads; ++i) {
+			Thread::ThreadID expected = nullptr;
+
+			if (state.threads[i].compare_exchange_strong(expected, thread))
+				return i;
+		}
+
+		return -1;
+	}
+
+	static void leave(int slot) noexcept
+	{
+		if (slot >= 0)
+			getState().threads[slot].store(nullptr);
+	}
+
+	static void reportViolation(int slot, const char* operation) noexcept
+	{
+		auto& state = getState();
+		auto thread = state.threads[slot].exchange(nullptr); //報告の間はこのスレッドを見張らない
+
+		++state.numViolations;
+
+		if (!state.hasFirstViolation.exchange(true)) {
+			std::strncpy(state.firstViolation, operation, maxDescriptionLength - 1);
+			state.firstViolation[maxDescriptionLength - 1] = 0;
+		}
+
+		if (state.abortOnViolation.load()) {
+			Logger::outputDebugString(String("Real-time safety violation in the audio callback: ") + operation);
+			jassertfalse;
+			std::abort();
+		}
+
+		state.threads[slot].store(thread);
+	}
+};
+
+
+//==============================================================================
+/** As the name suggest, this class does the actual audio processing. */
+class JuceDemoPluginAudioProcessor : public AudioProcessor,
+	private MidiKeyboardState::Listener
+{
+
+public:
+	//==============================================================================
+	JuceDemoPluginAudioProcessor()
+		: AudioProcessor(getBusesProperties()),
+		state(*this, nullptr, "state",
+			{ std::make_unique<AudioParameterFloat>("gain",  "Gain",           NormalisableRange<float>(0.0f, 1.0f), 0.9f),
+			  std::make_unique<AudioParameterFloat>("delay", "Delay Feedback", NormalisableRange<float>(0.0f, 1.0f), 0.5f) })
+	{
+		// Add a sub-tree to store the state of our UI
+		lastPosInfo.resetToDefault();
+
+		state.state.addChild({ "uiState", { { "width",  400 }, { "height", 200 } }, {} }, -1, nullptr);
+
+		gainAutomation.attach(state.getRawParameterValue("gain"));
+		delayAutomation.attach(state.getRawParameterValue("delay"));
+
+		keyboardState.addListener(this);
+
+		//スタンドアロンにはホストのトランスポートがないので、最初から試聴する
+		auditionEnabled = wrapperType == wrapperType_Standalone;
+
+		//まだ他のスレッドからは見えないので、どのスレッドで作られても直接渡してよい
+		history.reset(progression);
+		publishCurrentProgression();
+		playingProgression = publishedProgression.load();
+
+		loadAudioFile();
+
+		//setStateInformationとupdateTrackPropertiesはホストのどのスレッドからも呼ばれうるので、
+		//WeakReferenceが共有する参照はここ(生成したスレッド)で先に作っておく
+		WeakReference<JuceDemoPluginAudioProcessor> createSharedReference(this);
+		ignoreUnused(createSharedReference);
+	}
+
+	~JuceDemoPluginAudioProcessor()
+	{
+		//書き出し中なら終わるのを待つ
+		if (audioExportThread != nullptr)
+			audioExportThread->stopThread(-1);
+
+		keyboardState.removeListener(this);
+	}
+
+	//==============================================================================
+	bool isBusesLayoutSupported(const BusesLayout& layouts) const override
+	{
+		// Only mono/stereo and input/output must have same layout
+		const auto& mainOutput = layouts.getMainOutputChannelSet();
+		const auto& mainInput = layouts.getMainInputChannelSet();
+
+		// input and output layout must either be the same or the input must be disabled altogether
+		if (!mainInput.isDisabled() && mainInput != mainOutput)
+			return false;
+
+		// do not allow disabling the main buses
+		if (mainOutput.isDisabled())
+			return false;
+
+		// only allow stereo and mono
+		if (mainOutput.size() > 2)
+			return false;
+
+		return true;
+	}
+
+	juce::AudioParameterFloat* speed;
+	int currentNote, lastNoteValue;
+	int time;
+	float rate;
+	juce::SortedSet<int> notes;
+
+
+	// プラグインをロードした時やホスト側のセットアップ処理を実行した時にホストから呼び出される。
+	void prepareToPlay(double newSampleRate, int samplesPerBlock) override
+	{
+		telemetry.setSampleRate(newSampleRate);
+		loadMeasurer.reset(newSampleRate, samplesPerBlock);
+		peakBlockLoad = 0;
+
+		// Synthesiserオブジェクトにホストアプリケーションのサンプリングレートをセットする
+		synth.setCurrentPlaybackSampleRate(newSampleRate);
+		//押鍵状態の表示を初期化する
+		soundingNotes.clear();
+		publishedNotes.store(soundingNotes);
+
+		//ディレイのリングバッファはここで確保し、processBlockでは確保しない
+		if (isUsingDoublePrecision())
+		{
+			delayBufferDouble.setSize(2, delayBufferLength);
+			delayBufferFloat.setSize(1, 1);
+		}
+		else
+		{
+			delayBufferFloat.setSize(2, delayBufferLength);
+			delayBufferDouble.setSize(1, 1);
+		}
+
+		gainAutomation.prepare(newSampleRate, automationRampSeconds);
+		delayAutomation.prepare(newSampleRate, automationRampSeconds);
+
+		reset();
+		silentSamples = 0;
+		stepCursor = {};
+
+		internalTransport.prepare(newSampleRate);
+		usingInternalTransport = false;
+
+		stopCachedBars();
+		cachedStepEvents.ensureSize(midiBufferBytes);
+		blockEvents.ensureSize(midiBufferBytes);
+		spareBlockEvents.ensureSize(midiBufferBytes);
+		ownMidiStorage[0] = blockEvents.data.begin();
+		ownMidiStorage[1] = spareBlockEvents.data.begin();
+		cachedBarFadeLength = jmax(1, (int)(cachedBarFadeSeconds * newSampleRate));
+	}
+	// プラグインを非アクティブ化した時や削除する時にホストから呼び出される。
+	void releaseResources() override
+	{
+		//押鍵状態の表示を初期化する
+		soundingNotes.clear();
+		publishedNotes.store(soundingNotes);
+	}
+
+	void reset() override
+	{
+		// Use this method as the place to clear any delay lines, buffers, etc, as it
+		// means there's been a break in the audio's continuity.
+		delayBufferFloat.clear();
+		delayBufferDouble.clear();
+		delayPosition = 0;
+	}
+
+	//==============================================================================
+	//アプリケーションからオーディオバッファとMIDIバッファの参照を取得してオーディオレンダリングを実行
+	void processBlock(AudioBuffer<float>& buffer, MidiBuffer& midiMessages) override
+	{
+	   #if CHORDP_RT_SAFETY_HOOKS
+		const RealtimeSafetyChecker::ScopedAudioCallback realtimeSafetyScope;
+	   #endif
+
+		jassert(!isUsingDoublePrecision());
+		process(buffer, midiMessages, delayBufferFloat);
+	}
+
+	//64bitミックスエンジンのホスト向け。floatと同じテンプレートのコードで処理する
+	void processBlock(AudioBuffer<double>& buffer, MidiBuffer& midiMessages) override
+	{
+	   #if CHORDP_RT_SAFETY_HOOKS
+		const RealtimeSafetyChecker::ScopedAudioCallback realtimeSafetyScope;
+	   #endif
+
+		jassert(isUsingDoublePrecision());
+		process(buffer, midiMessages, delayBufferDouble);
+	}
+
+	bool supportsDoublePrecisionProcessing() const override { return true; }
+
+	template <typename FloatType>
+	void process(AudioBuffer<FloatType>& buffer, MidiBuffer& midiMessages, AudioBuffer<FloatType>& delayBuffer)
+	{
+		auto blockStart = Time::getHighResolutionTicks();
+
+		//入力を確保済みのバッファに写してからノートを加え、最後にホストのバッファと中身を交換する
+		blockEvents.clear();
+		blockEvents.addEvents(midiMessages, 0, -1, 0);
+
+		renderBlock(buffer, blockEvents, delayBuffer);
+		returnBlockEvents(midiMessages);
+		publishedNotes.store(soundingNotes);
+
+		//実測値をテレメトリのリングに書く(待たない)
+		AudioTelemetry::Record record;
+		record.seconds = Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - blockStart);
+
+		//ブロックの長さ(実時間の持ち時間)に対する処理時間の割合を測る
+		loadMeasurer.registerRenderTime(record.seconds * 1000.0, buffer.getNumSamples());
+		auto blockLoad = record.seconds * getSampleRate() / jmax(1, buffer.getNumSamples());
+
+		if (blockLoad > peakBlockLoad.load(std::memory_order_relaxed))
+			peakBlockLoad.store(blockLoad, std::memory_order_relaxed);
+
+		//書くのはオーディオスレッドだけなので、読んで足して書けばよい
+		totalBlockLoad.store(totalBlockLoad.load(std::memory_order_relaxed) + blockLoad, std::memory_order_relaxed);
+		numBlocksMeasured.store(numBlocksMeasured.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+		record.smoothedLoad = loadMeasurer.getLoadAsProportion();
+		record.numOverruns = loadMeasurer.getXRunCount();
+		record.numSamples = buffer.getNumSamples();
+		record.numEvents = midiMessages.getNumEvents();
+		record.numVoices = synth.getNumActiveVoices();
+		record.peak = buffer.hasBeenCleared() ? 0.0f : (float)buffer.getMagnitude(0, buffer.getNumSamples());
+		telemetry.push(record);
+	}
+
+	template <typename FloatType>
+	void renderBlock(AudioBuffer<FloatType>& buffer, MidiBuffer& midiMessages, AudioBuffer<FloatType>& delayBuffer)
+	{
+		//このブロックで鳴らすコード進行
+		playingProgression = &acquirePublishedProgression();
+
+		ScopedNoDenormals noDenormals;
+
+		//ホストがオフラインで書き出している間は高品質の設定にする
+		if (isNonRealtime() != synth.isHighQuality())
+			synth.setRenderQuality(isNonRealtime() ? SamplerVoiceBank::getOfflineQuality() : SamplerVoiceBank::getRealtimeQuality());
+
+		int totalNumInputChannels = getTotalNumInputChannels();
+		int totalNumOutputChannels = getTotalNumOutputChannels();
+
+		//midiメッセージを追加
+		//ホストの再生位置からこのブロック内でステップが切り替わる位置を求め、そのサンプル位置にノートを置く
+		auto hasPosition = updateCurrentTimeInfo(buffer.getNumSamples());
+
+		//画面の鍵盤で弾いたノートをブロックの先頭に加え、入力と合わせて押鍵状態に反映する。
+		//生成するノートは鳴らす順にtriggerStepで反映する
+		keyboardEvents.popInto(midiMessages);
+
+		for (const auto metadata : midiMessages)
+			soundingNotes.apply(metadata.getMessage());
+
+		if (hasPosition)
+			addStepEvents(midiMessages, lastPosInfo, buffer.getNumSamples());
+
+		//エディタへ再生状態を送る(変わったときだけキューに入る)
+		AudioStatusChannel::Status status;
+		status.position = lastPosInfo;
+		status.step = hasPosition ? getStepAt(lastPosInfo) : -1;
+		status.numVoices = synth.getNumActiveVoices();
+		statusChannel.push(status);
+
+		//再生中の小節、ステップと1小節のステップ数(止まっていれば-1)をエディタに知らせる
+		auto playhead = -1;
+
+		if (hasPosition && lastPosInfo.isPlaying) {
+			//表示には16で折り返さない小節内の位置を使う(6/8なら0〜23)
+			auto numerator = lastPosInfo.timeSigNumerator;
+			int bar, patternStep;
+			ChordStepEngine::getBarAndStep(status.step, numerator, playingProgression->getNumBars(), bar, patternStep);
+			playhead = Playhead::pack(bar, ChordStepEngine::getStepInBar(status.step, numerator), ChordStepEngine::getStepsPerBar(numerator));
+		}
+
+		playheadPosition.store(playhead, std::memory_order_relaxed);
+
+		//鳴っているボイスも届くイベントもなければ、合成と出力段を飛ばす。
+		//clear()したバッファはhasBeenCleared()が立つので、無音フラグを扱えるホストには無音として伝わる
+		//パラメータはアイドル中も進めておき、鳴り出したブロックが古い値からランプしないようにする
+		if (isIdle(buffer, midiMessages)) {
+			buffer.clear();
+			gainAutomation.beginBlock();
+			delayAutomation.beginBlock();
+			gainAutomation.skip(buffer.getNumSamples());
+			delayAutomation.skip(buffer.getNumSamples());
+			return;
+		}
+
+		// オーディオバッファのサンプルデータをクリア
+		for (auto i = totalNumInputChannels; i < totalNumOutputChannels; i++) {
+			buffer.clear(i, 0, buffer.getNumSamples());
+		}
+		//    // Synthesiserオブジェクトにオーディオバッファの参照とMIDIバッファの参照を渡して、オーディオレンダリング
+		synth.renderNextBlock(buffer, midiMessages, 0, buffer.getNumSamples());
+
+		//キャッシュから鳴らした小節は音声を足し込み、そのノートはMIDI出力にだけ流す
+		if (numPlayingBars > 0)
+			mixCachedBars(buffer);
+
+		if (!cachedStepEvents.isEmpty()) {
+			midiMessages.addEvents(cachedStepEvents, 0, buffer.getNumSamples(), 0);
+			cachedStepEvents.clear();
+		}
+
+		//出力段: ランプの終わる位置でブロックを分割し、ランプ区間だけ補間、残りは一定値で処理する
+		gainAutomation.beginBlock();
+		delayAutomation.beginBlock();
+
+		for (int pos = 0; pos < buffer.getNumSamples();)
+		{
+			auto segment = buffer.getNumSamples() - pos;
+
+			if (gainAutomation.isRamping())
+				segment = jmin(segment, gainAutomation.getRemainingRampSamples());
+
+			if (delayAutomation.isRamping())
+				segment = jmin(segment, delayAutomation.getRemainingRampSamples());
+
+			applyDelay(buffer, delayBuffer, pos, segment, delayAutomation.getCurrentValue(), delayAutomation.getValueAfter(segment));
+			applyGain(buffer, delayBuffer, pos, segment, gainAutomation.getCurrentValue(), gainAutomation.getValueAfter(segment));
+
+			gainAutomation.skip(segment);
+			delayAutomation.skip(segment);
+			pos += segment;
+		}
+
+		//ボイスが止まった後もディレイの残響が1周分続けて無音になるまではアイドルにしない
+		if (synth.getNumActiveVoices() == 0 && numPlayingBars == 0 && buffer.getMagnitude(0, buffer.getNumSamples()) < (FloatType)silenceThreshold)
+			silentSamples = jmin(silentSamples + buffer.getNumSamples(), delayBufferLength);
+		else
+			silentSamples = 0;
+	}
+
+	//このブロックの範囲[ppq, ppq + numSamples)にあるステップの境界ごとにノートを追加する。
+	//サンプル位置は曲頭からの絶対位置で切り上げるので、ブロックの区切り方によらず同じ位置になる
+	void addStepEvents(MidiBuffer& midiMessages, const AudioPlayHead::CurrentPositionInfo& pos, int numSamples)
+	{
+		auto numerator = pos.timeSigNumerator;
+		auto stepLength = ChordStepEngine::getStepLength(numerator, pos.timeSigDenominator);
+		auto samplesPerStep = stepLength * getSampleRate() * 60.0 / (pos.bpm > 0 ? pos.bpm : 120.0);
+		auto startStep = pos.ppqPosition / stepLength;
+		auto k = (int64)std::floor(startStep + 1.0e-6);
+
+		//再生開始や再生位置の移動: ブロック先頭のステップをまだ鳴らしていなければ先頭で鳴らす
+		triggerStep(midiMessages, k, numerator, 0);
+
+		if (!pos.isPlaying)
+			interruptCachedBars();
+
+		if (!pos.isPlaying || samplesPerStep <= 0)
+			return;
+
+		for (++k;; ++k) {
+			auto offset = (int)std::ceil((k - startStep) * samplesPerStep - 1.0e-6);
+
+			if (offset >= numSamples)
+				break;
+
+			triggerStep(midiMessages, k, numerator, jmax(0, offset));
+		}
+	}
+
+	//ブロックのイベントをホストのバッファと交換する(ポインタの入れ替えだけでメモリ確保はしない)。
+	//ホストが同じMidiBufferを使い続ければ、次のブロックでは前に渡した確保済みの領域が戻ってくる。
+	//最初のブロックなどでホストの領域が戻ってきたら、確保済みの予備と取り替えてそちらは使わない
+	void returnBlockEvents(MidiBuffer& output) noexcept
+	{
+		output.swapWith(blockEvents);
+
+		if (!isOwnMidiStorage(blockEvents) && isOwnMidiStorage(spareBlockEvents))
+			blockEvents.swapWith(spareBlockEvents);
+	}
+
+	bool isOwnMidiStorage(const MidiBuffer& b) const noexcept
+	{
+		auto* p = b.data.begin();
+		return p != nullptr && (p == ownMidiStorage[0] || p == ownMidiStorage[1]);
+	}
+
+	static int64 getStepAt(const AudioPlayHead::CurrentPositionInfo& pos)
+	{
+		auto stepLength = ChordStepEngine::getStepLength(pos.timeSigNumerator, pos.timeSigDenominator);
+		return (int64)std::floor(pos.ppqPosition / stepLength + 1.0e-6);
+	}
+
+	void triggerStep(MidiBuffer& midiMessages, int64 k, int numerator, int sampleOffset)
+	{
+		ChordStep notes;
+
+		if (!stepCursor.advance(*playingProgression, k, numerator, notes))
+			return;
+
+		if (notes.clearsKeyboard)
+			soundingNotes.clear();
+
+		//キャッシュから鳴らす小節のノートは合成せず、鍵盤の表示とMIDI出力にだけ使う
+		if (renderCache != nullptr && playStepFromRenderCache(k, numerator, sampleOffset)) {
+			for (int i = 0; i < notes.numNotes; i++) {
+				auto message = juce::MidiMessage::noteOn(1, notes.notes[i], (uint8)127);
+				soundingNotes.apply(message);
+				cachedStepEvents.addEvent(message, sampleOffset);
+			}
+			return;
+		}
+
+		for (int i = 0; i < notes.numNotes; i++) {
+			auto message = stepNotesReleaseOnly ? juce::MidiMessage::noteOff(1, notes.notes[i])
+				: juce::MidiMessage::noteOn(1, notes.notes[i]/*noteNumber*/, (uint8)127);
+			soundingNotes.apply(message);
+			midiMessages.addEvent(message, sampleOffset);
+		}
+	}
+
+	//小節の先頭から続けて再生したときだけ、その小節をキャッシュから鳴らす。
+	//再生位置が飛んだときや途中から入った小節は、これまでどおりその場で合成する
+	bool playStepFromRenderCache(int64 k, int numerator, int sampleOffset)
+	{
+		auto isContinuous = k == lastTriggeredStep + 1;
+		lastTriggeredStep = k;
+
+		if (!isContinuous) {
+			interruptCachedBars();
+			currentBarIsCached = false;
+			return false;
+		}
+
+		auto stepsPerBar = (int64)ChordStepEngine::getStepsPerBar(numerator);
+
+		if (((k % stepsPerBar) + stepsPerBar) % stepsPerBar != 0)
+			return currentBarIsCached;
+
+		int bar, step;
+		ChordStepEngine::getBarAndStep(k, numerator, playingProgression->getNumBars(), bar, step);
+
+		//次の小節も先に頼んでおく(最初の1周目から間に合うように)
+		renderCache->request(getBarCacheKey((bar + 1) % playingProgression->getNumBars(), numerator));
+
+		auto key = getBarCacheKey(bar, numerator);
+		BarRenderCache::Entry::Ptr entry;
+		currentBarIsCached = numPlayingBars < maxPlayingBars && renderCache->tryGet(key, entry);
+
+		if (!currentBarIsCached) {
+			renderCache->request(key);
+			return false;
+		}
+
+		playingBars[numPlayingBars++] = { entry, -sampleOffset, 0 };
+		return true;
+	}
+
+	BarRenderCache::Key getBarCacheKey(int bar, int numerator) const
+	{
+		BarRenderCache::Key key;
+		auto& playing = *playingProgression;
+
+		key.timeSigNumerator = numerator;
+		key.timeSigDenominator = lastPosInfo.timeSigDenominator;
+		key.bpm = lastPosInfo.bpm > 0 ? lastPosInfo.bpm : 120.0;
+		key.numTailBars = BarRenderCache::getNumTailBars(key.bpm, key.timeSigNumerator, key.timeSigDenominator);
+
+		//ループするので、続く小節は進行の頭に戻って数える
+		for (int i = 0; i <= key.numTailBars; i++) {
+			auto b = (bar + i) % playing.getNumBars();
+			key.bars[i][0] = playing.getRoot(b);
+			key.bars[i][1] = playing.getType(b);
+			key.bars[i][2] = playing.getPattern(b);
+		}
+
+		key.pitch = playing.getPitch();
+		key.tone = playing.getTone();
+		key.sampleRate = getSampleRate();
+		key.sample = synth.getSample().get();
+		return key;
+	}
+
+	template <typename FloatType>
+	void mixCachedBars(AudioBuffer<FloatType>& buffer)
+	{
+		auto numSamples = buffer.getNumSamples();
+		auto numChannels = jmin(2, buffer.getNumChannels());
+
+		for (int i = 0; i < numPlayingBars;) {
+			auto& bar = playingBars[i];
+			auto& audio = bar.entry->audio;
+			auto destStart = jmax(0, -bar.position);
+			auto sourceStart = jmax(0, bar.position);
+			auto num = jmin(numSamples - destStart, bar.entry->length - sourceStart);
+
+			if (bar.fadeRemaining > 0)
+				num = jmin(num, bar.fadeRemaining);
+
+			for (int ch = 0; ch < numChannels && num > 0; ++ch) {
+				auto* src = audio.getReadPointer(jmin(ch, audio.getNumChannels() - 1), sourceStart);
+				auto* dest = buffer.getWritePointer(ch, destStart);
+
+				if (bar.fadeRemaining > 0) {
+					for (int j = 0; j < num; ++j)
+						dest[j] += (FloatType)(src[j] * (float)(bar.fadeRemaining - j) / (float)cachedBarFadeLength);
+				}
+				else {
+					for (int j = 0; j < num; ++j)
+						dest[j] += (FloatType)src[j];
+				}
+			}
+
+			bar.position += numSamples;
+
+			if (bar.fadeRemaining > 0)
+				bar.fadeRemaining = jmax(0, bar.fadeRemaining - jmax(0, num));
+
+			auto finished = bar.position >= bar.entry->length || (bar.wasInterrupted && bar.fadeRemaining == 0);
+
+			if (finished) {
+				playingBars[i] = std::move(playingBars[--numPlayingBars]);
+				playingBars[numPlayingBars] = {};
+			}
+			else {
+				++i;
+			}
+		}
+	}
+
+	//停止や再生位置の移動で、まだ最後まで弾いていない小節を短くフェードアウトさせる
+	void interruptCachedBars() noexcept
+	{
+		lastTriggeredStep = std::numeric_limits<int64>::min() + 1;
+		currentBarIsCached = false;
+
+		for (int i = 0; i < numPlayingBars; ++i) {
+			auto& bar = playingBars[i];
+
+			if (!bar.wasInterrupted && bar.position < bar.entry->barLength) {
+				bar.wasInterrupted = true;
+				bar.fadeRemaining = cachedBarFadeLength;
+			}
+		}
+	}
+
+	void stopCachedBars()
+	{
+		for (auto& bar : playingBars)
+			bar = {};
+
+		numPlayingBars = 0;
+		currentBarIsCached = false;
+		lastTriggeredStep = std::numeric_limits<int64>::min() + 1;
+		cachedStepEvents.clear();
+	}
+
+	template <typename FloatType>
+	bool isIdle(const AudioBuffer<FloatType>& buffer, const MidiBuffer& midiMessages)
+	{
+		if (!midiMessages.isEmpty() || !cachedStepEvents.isEmpty() || synth.getNumActiveVoices() > 0
+			|| numPlayingBars > 0 || silentSamples < delayBufferLength)
+			return false;
+
+		//入力をそのまま通している場合は入力も無音であること
+		for (auto i = 0; i < getTotalNumInputChannels(); ++i)
+			if (buffer.getMagnitude(i, 0, buffer.getNumSamples()) > 0)
+				return false;
+
+		return true;
+	}
+
+
+
+	//==============================================================================
+	bool hasEditor() const override { return true; }
+
+	AudioProcessorEditor* createEditor() override
+	{
+		return new JuceDemoPluginAudioProcessorEditor(*this);
+	}
+
+	//==============================================================================
+	const String getName() const override { return "Chord Progressor"; }
+	bool acceptsMidi() const override { return true; }
+	bool producesMidi() const override { return true; }
+	double getTailLengthSeconds() const override { return 0.0; }
+
+	//==============================================================================
+	int getNumPrograms() override { return 0; }
+	int getCurrentProgram() override { return 0; }
+	void setCurrentProgram(int) override {}
+	const String getProgramName(int) override { return {}; }
+	void changeProgramName(int, const String&) override {}
+
+	//==============================================================================
+	//状態はXMLを使わないバイナリで保存する。先頭に識別子と版番号を置き、版を上げるときは末尾に項目を足すだけにする。
+	//古い版のデータはそのまま読め、新しい版のデータも知っている項目までは読める。
+	//識別子がなければ以前のXML形式として読む
+	static constexpr int stateMagic = 0x53525043; // "CPRS"
+	static constexpr int stateVersion = 1;
+
+	void getStateInformation(MemoryBlock& destData) override
+	{
+		MemoryOutputStream out(destData, false);
+
+		out.writeInt(stateMagic);
+		out.writeInt(stateVersion);
+
+		//パラメータ
+		out.writeFloat(state.getRawParameterValue("gain")->load());
+		out.writeFloat(state.getRawParameterValue("delay")->load());
+
+		//エディタの大きさ
+		auto uiState = state.state.getChildWithName("uiState");
+		out.writeShort((short)(int)uiState.getProperty("width", 400));
+		out.writeShort((short)(int)uiState.getProperty("height", 200));
+
+		//コード進行
+		progression.writeTo(out);
+
+		//試聴用のトランスポート
+		out.writeBool(isAuditionEnabled());
+		out.writeDouble(internalTransport.getTempo());
+		out.writeByte((char)internalTransport.getTimeSigNumerator());
+		out.writeByte((char)internalTransport.getTimeSigDenominator());
+
+		//読み込んだサンプル(空なら内蔵のピアノ)
+		out.writeString(sampleFile.getFullPathName());
+	}
+
+	void setStateInformation(const void* data, int sizeInBytes) override
+	{
+		MemoryInputStream in(data, (size_t)jmax(0, sizeInBytes), false);
+
+		if (sizeInBytes < 8 || in.readInt() != stateMagic) {
+			// Restore our plug-in's state from the xml representation stored by earlier versions.
+			if (auto xmlState = getXmlFromBinary(data, sizeInBytes))
+				state.replaceState(ValueTree::fromXml(*xmlState));
+
+			return;
+		}
+
+		if (in.readInt() < 1)
+			return;
+
+		setParameterValue("gain", in.readFloat());
+		setParameterValue("delay", in.readFloat());
+
+		//読むのはここで済ませ、進行や履歴などメッセージスレッドの状態への反映はメッセージスレッドで行う
+		RestoredState restored;
+		restored.width = (int)in.readShort();
+		restored.height = (int)in.readShort();
+
+		//範囲外の値は丸めて、最後に1回で差し替える
+		restored.progression.readFrom(in);
+
+		restored.auditionEnabled = in.readBool();
+		restored.tempo = in.readDouble();
+		restored.timeSigNumerator = (int)in.readByte();
+		restored.timeSigDenominator = (int)in.readByte();
+		restored.samplePath = in.readString();
+
+		if (MessageManager::existsAndIsCurrentThread()) {
+			applyRestoredState(restored);
+			return;
+		}
+
+		//ホストが先にプロセッサを消していたら何もしない
+		WeakReference<JuceDemoPluginAudioProcessor> safeThis(this);
+
+		MessageManager::callAsync([safeThis, restored]
+			{
+				if (safeThis != nullptr)
+					safeThis->applyRestoredState(restored);
+			});
+	}
+
+	//setStateInformationで読んだ内容のうち、メッセージスレッドだけが触る状態
+	struct RestoredState
+	{
+		int width = 400, height = 200;
+		ChordProgression progression;
+		bool auditionEnabled = false;
+		double tempo = 120.0;
+		int timeSigNumerator = 4, timeSigDenominator = 4;
+		String samplePath;
+	};
+
+	void applyRestoredState(const RestoredState& restored)
+	{
+		auto uiState = state.state.getChildWithName("uiState");
+		uiState.setProperty("width", restored.width, nullptr);
+		uiState.setProperty("height", restored.height, nullptr);
+
+		setProgression(restored.progression, false);
+
+		setAuditionEnabled(restored.auditionEnabled);
+		internalTransport.setTempo(restored.tempo);
+		internalTransport.setTimeSignature(restored.timeSigNumerator, restored.timeSigDenominator);
+
+		restoreSample(restored.samplePath);
+
+		if (auto* editor = dynamic_cast<JuceDemoPluginAudioProcessorEditor*> (getActiveEditor()))
+			editor->updateProgressionDisplay();
+	}
+
+	//保存しておいたサンプルのパスから読み直す(空なら内蔵のピアノ)
+	void restoreSample(const String& path)
+	{
+		if (path.isEmpty()) {
+			if (sampleFile != File())
+				loadAudioFile();
+		}
+		else if (File(path) != sampleFile) {
+			loadSampleFile(File(path));
+		}
+	}
+
+	void setParameterValue(StringRef parameterID, float value)
+	{
+		if (auto* parameter = state.getParameter(parameterID))
+			parameter->setValueNotifyingHost(parameter->convertTo0to1(value));
+	}
+
+	//==============================================================================
+	void updateTrackProperties(const TrackProperties& properties) override
+	{
+		{
+			const ScopedLock sl(trackPropertiesLock);
+			trackProperties = properties;
+		}
+
+		WeakReference<JuceDemoPluginAudioProcessor> safeThis(this);
+
+		MessageManager::callAsync([safeThis]
+			{
+				if (safeThis != nullptr)
+					if (auto* editor = dynamic_cast<JuceDemoPluginAudioProcessorEditor*> (safeThis->getActiveEditor()))
+						editor->updateTrackProperties();
+			});
+	}
+
+
+
+	//synthsizer setup
+	void setupSampler(SharedSample::Ptr newSample) {
+		//差し替えはホストがprocessBlockを呼ぶ間持つコールバックのロックの中で行い、
+		//前のサンプルはロックを放した後、このスレッド(メッセージスレッド)で解放する
+		auto previous = synth.getSample();
+
+		{
+			const ScopedLock sl(getCallbackLock());
+
+			//128ボイス分の状態はSamplerVoiceBankが配列でまとめて持つ
+			synth.setSample(newSample);
+		}
+
+		if (renderCache != nullptr)
+			renderCache->setSample(newSample);
+	}
+
+	void setupSampler(AudioFormatReader& newReader) {
+		setupSampler(new SharedSample(newReader, 60, 0, 0.1, 10.0));
+	}
+
+	SharedSample::Ptr getSample() const {
+		return synth.getSample();
+	}
+
+	void loadAudioFile() {
+		//内蔵のピアノはインスタンス間で共有しているデコード済みのデータを使う
+		setupSampler(builtInPiano->sample);
+		sampleFile = File();
+	}
+
+
+	void loadSampleFile() {
+		AudioFormatManager formatManager;
+		formatManager.registerBasicFormats();
+
+		FileChooser chooser("Open audio file to play.", File::nonexistent, formatManager.getWildcardForAllFormats());
+
+		if (chooser.browseForFileToOpen()) {
+			loadSampleFile(chooser.getResult());
+		}
+
+
+	}
+
+	bool loadSampleFile(const File& file) {
+		AudioFormatManager formatManager;
+		formatManager.registerBasicFormats();
+
+		std::unique_ptr<AudioFormatReader> reader(formatManager.createReaderFor(file));
+
+		if (reader == nullptr)
+			return false;
+
+		setupSampler(*reader);
+		sampleFile = file;
+		return true;
+	}
+
+	//オフラインレンダリング用: trueの間はステップのノートをノートオフとして出す。
+	//区間の後の残響を描くとき、次の区間で同じ音が鳴り直して切れるところを再現する
+	void setStepNotesReleaseOnly(bool shouldReleaseOnly) {
+		stepNotesReleaseOnly = shouldReleaseOnly;
+	}
+
+	//ボイスもディレイの残響も鳴っていない
+	bool isSilent() const {
+		return synth.getNumActiveVoices() == 0 && numPlayingBars == 0 && silentSamples >= delayBufferLength;
+	}
+
+	ProgressionPreset createPreset(const String& name, const String& genre, const StringArray& tags) const
+	{
+		ProgressionPreset preset;
+		preset.name = name;
+		preset.genre = genre;
+		preset.tags = tags;
+		preset.progression = progression;
+		preset.samplePath = sampleFile.getFullPathName();
+		return preset;
+	}
+
+	void loadPreset(const ProgressionPreset& preset)
+	{
+		setProgression(preset.progression);
+		restoreSample(preset.samplePath);
+	}
+
+	//ホストのトランスポートが動いていないときに、内部のトランスポートで進行を鳴らすかどうか
+	void setAuditionEnabled(bool shouldAudition) { auditionEnabled = shouldAudition; }
+	bool isAuditionEnabled() const { return auditionEnabled; }
+
+	InternalTransport internalTransport;
+
+	//オーディオスレッドから届いた再生状態を読み込み、変わっていればtrueを返す(メッセージスレッドから呼ぶ)
+	bool pollAudioStatus() { return statusChannel.pull(); }
+	const AudioStatusChannel::Status& getAudioStatus() const { return statusChannel.getLatest(); }
+
+	//processBlockの実測値。メーターやログを使うときにstartCollecting()で収集を始める
+	AudioTelemetry telemetry;
+
+	//ブロックの長さに対する処理時間の割合(1.0で締め切りちょうど)。どのスレッドから読んでもよい
+	double getCpuLoad() const { return loadMeasurer.getLoadAsProportion(); }
+	int getNumOverruns() const { return loadMeasurer.getXRunCount(); }
+
+	//前回呼んでから最も重かったブロックの負荷を返し、記録をリセットする
+	double takePeakBlockLoad() noexcept { return peakBlockLoad.exchange(0); }
+
+	//これまでの全ブロックの負荷の合計とブロック数(なまらせていない平均を出すのに使う)
+	double getTotalBlockLoad() const noexcept { return totalBlockLoad.load(std::memory_order_relaxed); }
+	int64 getNumBlocksMeasured() const noexcept { return numBlocksMeasured.load(std::memory_order_relaxed); }
+
+	//再生中の小節と小節内のステップ。ステップ数は拍子で変わるので一緒に渡す(止まっているときはbarが-1)
+	struct Playhead
+	{
+		int bar = -1, step = -1, stepsPerBar = 16;
+
+		//1つのatomic<int>に入れるため、小節、1小節のステップ数、ステップを10ビットずつ詰める
+		static int pack(int bar, int step, int stepsPerBar) noexcept
+		{
+			return (bar << 20) | (jlimit(0, 1023, stepsPerBar) << 10) | jlimit(0, 1023, step);
+		}
+
+		static Playhead unpack(int packed) noexcept
+		{
+			Playhead p;
+
+			if (packed >= 0) {
+				p.bar = packed >> 20;
+				p.stepsPerBar = (packed >> 10) & 1023;
+				p.step = packed & 1023;
+			}
+
+			return p;
+		}
+	};
+
+	//どのスレッドから読んでもよい
+	Playhead getPlayhead() const noexcept { return Playhead::unpack(playheadPosition.load(std::memory_order_relaxed)); }
+
+	//小節ごとのレンダリング結果のキャッシュを使うかどうか(メッセージスレッドから呼ぶ)
+	void setRenderCacheEnabled(bool shouldBeEnabled, size_t memoryBudgetBytes = BarRenderCache::defaultMemoryBudget);
+	bool isRenderCacheEnabled() const { return renderCache != nullptr; }
+
+	//現在のコード進行をWAV/FLACに書き出す(拡張子で形式を選ぶ)。
+	//exportAudio()はファイルを選ばせた後、別スレッドでレンダリングし、終わったら結果を知らせる
+	bool exportAudio(const File& file);
+	void exportAudio();
+	bool isExportingAudio() const { return audioExportThread != nullptr && audioExportThread->isThreadRunning(); }
+
+	//現在のコード進行をStandard MIDI Fileに書き出す。テンポと拍子はホストの値を使う
+	bool exportMidi(const File& file);
+	File exportMidiToTempFile();
+
+	//Standard MIDI Fileからコード進行と奏法を読み込む。長すぎて先頭だけ読んだときは警告を出す
+	bool importMidi(const File& file);
+
+
+
+	MidiKeyboardState& getMidiKeyboardState() {
+		return keyboardState;
+	}
+
+	//直前のブロックの終わりで鳴っていたノート(どのスレッドから読んでもよい)
+	NoteBitmap getSoundingNotes() const noexcept { return publishedNotes.load(); }
+
+
+
+
+	TrackProperties getTrackProperties() const
+	{
+		const ScopedLock sl(trackPropertiesLock);
+		return trackProperties;
+	}
+
+	class SpinLockedPosInfo
+	{
+	public:
+		SpinLockedPosInfo() { info.resetToDefault(); }
+
+		// Wait-free, but setting new info may fail if the main thread is currently
+		// calling `get`. This is unlikely to matter in practice because
+		// we'll be calling `set` much more frequently than `get`.
+		void set(const AudioPlayHead::CurrentPositionInfo& newInfo)
+		{
+
+			const juce::SpinLock::ScopedTryLockType lock(mutex);
+
+			if (lock.isLocked())
+				info = newInfo;
+
+		}
+
+		AudioPlayHead::CurrentPositionInfo get() const noexcept
+		{
+			const juce::SpinLock::ScopedLockType lock(mutex);
+			return info;
+		}
+
+
+	private:
+		juce::SpinLock mutex;
+		AudioPlayHead::CurrentPositionInfo info;
+
+
+
+
+
+		//==============================================================================
+	};
+
+
+
+
+
+	//==============================================================================
+	// These properties are public so that our editor component can access them
+	// A bit of a hacky way to do it, but it's only a demo! Obviously in your own
+	// code you'll do this much more neatly..
+	// the chords, patterns, key and tone being edited on the message thread. After editing it,
+	// call commitProgression() to add it to the undo history and hand it to the audio thread.
+	ChordProgression progression;
+
+	//編集を確定する。前の版から変わっていれば履歴に積んでオーディオスレッドに渡す
+	void commitProgression()
+	{
+		if (history.push(progression))
+			publishProgression();
+	}
+
+	//進行をまとめて差し替える。undoableでなければ履歴もそこから始め直す(状態の読み込みやオフラインのエンジン)
+	void setProgression(const ChordProgression& newProgression, bool undoable = true)
+	{
+		progression = newProgression;
+
+		if (undoable) {
+			commitProgression();
+		}
+		else {
+			history.reset(progression);
+			publishProgression();
+		}
+	}
+
+	bool canUndoProgression() const noexcept { return history.canUndo(); }
+	bool canRedoProgression() const noexcept { return history.canRedo(); }
+
+	bool undoProgression()
+	{
+		if (!history.canUndo())
+			return false;
+
+		progression = history.undo();
+		publishProgression();
+		return true;
+	}
+
+	bool redoProgression()
+	{
+		if (!history.canRedo())
+			return false;
+
+		progression = history.redo();
+		publishProgression();
+		return true;
+	}
+
+	//レンダリング専用のエンジン(非リアルタイムで、1つのスレッドが進行の差し替えと処理の両方を行う)に進行を渡す。
+	//履歴は使わない。メッセージスレッド以外から進行を変えてよいのはこれだけ
+	void setRenderProgression(const ChordProgression& newProgression)
+	{
+		jassert(isNonRealtime());
+		progression = newProgression;
+		publishCurrentProgression();
+	}
+
+	// the on-screen keyboard plays into this on the message thread. The audio thread never
+	// touches it - notes reach it through keyboardEvents, and the display reads getSoundingNotes().
+	MidiKeyboardState keyboardState;
+
+	// this keeps a copy of the last set of time info that was acquired during an audio
+	// callback. Only the audio thread touches it - the UI gets it through getAudioStatus().
+	AudioPlayHead::CurrentPositionInfo lastPosInfo;
+
+	// Our plug-in's current state
+	AudioProcessorValueTreeState state;
+
+
+private:
+	//==============================================================================
+	/** This is the editor component that our filter will display. */
+	//GUI‚Ì•ÒW
+	class JuceDemoPluginAudioProcessorEditor : public AudioProcessorEditor,
+		public FileDragAndDropTarget,
+		private Timer,
+		private Value::Listener,
+		private Button::Listener
+	{
+	public:
+
+
+	
+		
+		
+		int g_push[8] = { 0,0,0,0,0,0,0,0 };
+
+		const String Pattern_Name[5] = { "Normal","pop","wave","stylish","Jazz" };//奏法名の指定
+		const String Genre_Name[8] = { "J-POP","Rock","Jazz","EDM","Idol","Ballade","Anime","Game" };//ジャンル名の指定
+		String currentGenre;
+
+		const String Chord_Name[12] = { "C","C#","D" ,"D#" ,"E" ,"F" ,"F#" ,"G" ,"G#" ,"A" ,"A#" ,"B" }; //コード名の指定
+		const String Chord_Type[7] = { "","m","M7","m7","7","m(-5)","m7(-5)" }; //コード名(種類)の指定
+
+		//カラーコードでボタンの色指定
+		const Colour backg_1 = juce::Colour::fromRGB((uint8)119, (uint8)149, (uint8)198);//こいあお
+		const Colour backg_2 = juce::Colour::fromRGB((uint8)186, (uint8)204, (uint8)234);//うすいあお
+		const Colour backg_3 = juce::Colour::fromRGB((uint8)149, (uint8)202, (uint8)170);//こいみどり
+		const Colour backg_4 = juce::Colour::fromRGB((uint8)207, (uint8)227, (uint8)210);//うすいみどり
+		const Colour backg_5 = juce::Colour::fromRGB((uint8)204, (uint8)204, (uint8)204);//はいいろ
+
+
+		//GUIの作成
+		JuceDemoPluginAudioProcessorEditor(JuceDemoPluginAudioProcessor& owner)
+			: AudioProcessorEditor(owner),
+			midiKeyboard(owner.keyboardState, MidiKeyboardComponent::horizontalKeyboard),
+			gainAttachment(owner.state, "gain", gainSlider),
+			delayAttachment(owner.state, "delay", delaySlider),
+			progression(owner.progression),
+			telemetryMeter(owner.telemetry)
+		{
+
+			//Using Button Attach
+			addAndMakeVisible(pianoRoll);
+
+			//processBlockの実測値を下端に表示する
+			owner.telemetry.startCollecting();
+			addAndMakeVisible(telemetryMeter);
+
+			addAndMakeVisible(progressionGrid);
+			progressionGrid.cellColour = backg_4;
+			progressionGrid.chordRowProportion = 70.0f / 120.0f;
+			progressionGrid.rowGapProportion = 20.0f / 120.0f;
+			progressionGrid.onPatternClicked = [this](int bar) { updatePattern(bar, progression.getPattern(bar)); };
+
+			addAndMakeVisible(Button_g1);
+			Button_g1.setButtonText("J-POP");
+			Button_g1.setColour(juce::TextButton::buttonColourId, backg_5);
+			Button_g1.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
+			Button_g1.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
+			Button_g1.addListener(this);
+
+			addAndMakeVisible(Button_g2);
+			Button_g2.setButtonText("Rock");
+			Button_g2.setColour(juce::TextButton::buttonColourId, backg_5);
+			Button_g2.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
+			Button_g2.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
+			Button_g2.addListener(this);
+
+			addAndMakeVisible(Button_g3);
+			Button_g3.setButtonText("Jazz");
+			Button_g3.setColour(juce::TextButton::buttonColourId, backg_5);
+			Button_g3.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
+			Button_g3.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
+			Button_g3.addListener(this);
+
+			addAndMakeVisible(Button_g4);
+			Button_g4.setButtonText("EDM");
+			Button_g4.setColour(juce::TextButton::buttonColourId, backg_5);
+			Button_g4.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
+			Button_g4.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
+			Button_g4.addListener(this);
+
+			addAndMakeVisible(Button_g5);
+			Button_g5.setButtonText("Idol");
+			Button_g5.setColour(juce::TextButton::buttonColourId, backg_5);
+			Button_g5.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
+			Button_g5.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
+			Button_g5.addListener(this);
+
+			addAndMakeVisible(Button_g6);
+			Button_g6.setButtonText("Ballade");
+			Button_g6.setColour(juce::TextButton::buttonColourId, backg_5);
+			Button_g6.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
+			Button_g6.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
+			Button_g6.addListener(this);
+
+			addAndMakeVisible(Button_g7);
+			Button_g7.setButtonText("Anime");
+			Button_g7.setColour(juce::TextButton::buttonColourId, backg_5);
+			Button_g7.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
+			Button_g7.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
+			Button_g7.addListener(this);
+
+			addAndMakeVisible(Button_g8);
+			Button_g8.setButtonText("Game");
+			Button_g8.setColour(juce::TextButton::buttonColourId, backg_5);
+			Button_g8.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
+			Button_g8.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
+			Button_g8.addListener(this);
+
+			addAndMakeVisible(Button_L);
+			Button_L.setButtonText("<");
+			Button_L.setColour(juce::TextButton::buttonColourId, backg_5);
+			Button_L.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
+			Button_L.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
+			Button_L.addListener(this);
+
+			addAndMakeVisible(Button_R);
+			Button_R.setColour(juce::TextButton::buttonColourId, backg_5);
+			Button_R.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
+			Button_R.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
+			Button_R.setButtonText(">");
+			Button_R.addListener(this);
+
+			addAndMakeVisible(Button_keyL);
+			Button_keyL.setButtonText("-");
+			Button_keyL.setColour(juce::TextButton::buttonColourId, backg_5);
+			Button_keyL.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
+			Button_keyL.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
+			Button_keyL.addListener(this);
+
+			addAndMakeVisible(Button_keyR);
+			Button_keyR.setButtonText("+");
+			Button_keyR.setColour(juce::TextButton::buttonColourId, backg_5);
+			Button_keyR.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
+			Button_keyR.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
+			Button_keyR.addListener(this);
+
+			addAndMakeVisible(Button_toneL);
+			Button_toneL.setButtonText("<");
+			Button_toneL.setColour(juce::TextButton::buttonColourId, backg_5);
+			Button_toneL.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
+			Button_toneL.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
+			Button_toneL.addListener(this);
+
+			addAndMakeVisible(Button_toneR);
+			Button_toneR.setButtonText(">");
+			Button_toneR.setColour(juce::TextButton::buttonColourId, backg_5);
+			Button_toneR.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
+			Button_toneR.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
+			Button_toneR.addListener(this);
+
+			addAndMakeVisible(Button_export);
+			Button_export.setButtonText("WAV");
+			Button_export.setColour(juce::TextButton::buttonColourId, backg_5);
+			Button_export.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
+			Button_export.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
+			Button_export.addListener(this);
+
+			addAndMakeVisible(midiDragSource);
+			midiDragSource.colour = backg_5;
+			midiDragSource.createFile = [this] { return getProcessor().exportMidiToTempFile(); };
+
+			//プリセットの検索と保存
+			addAndMakeVisible(presetSearchBox);
+			presetSearchBox.setTextToShowWhenEmpty("Search / name #tag", juce::Colours::grey);
+			presetSearchBox.onTextChange = [this] { updatePresetResults(); };
+
+			addAndMakeVisible(presetResults);
+			presetResults.setTextWhenNothingSelected("Presets");
+			presetResults.onChange = [this] { loadSelectedPreset(); };
+
+			addAndMakeVisible(Button_undo);
+			Button_undo.setButtonText("Undo");
+			addAndMakeVisible(Button_redo);
+			Button_redo.setButtonText("Redo");
+
+			for (auto* b : { &Button_undo, &Button_redo }) {
+				b->setColour(juce::TextButton::buttonColourId, backg_5);
+				b->setColour(juce::TextButton::textColourOffId, juce::Colours::black);
+				b->setColour(juce::TextButton::textColourOnId, juce::Colours::black);
+				b->addListener(this);
+			}
+
+			addAndMakeVisible(Button_savePreset);
+			Button_savePreset.setButtonText("Save");
+			Button_savePreset.setColour(juce::TextButton::buttonColourId, backg_5);
+			Button_savePreset.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
+			Button_savePreset.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
+			Button_savePreset.addListener(this);
+
+			updatePresetResults();
+
+			addAndMakeVisible(Button_audition);
+			Button_audition.setButtonText("Play");
+			Button_audition.setClickingTogglesState(true);
+			Button_audition.setToggleState(owner.isAuditionEnabled(), dontSendNotification);
+			Button_audition.setColour(juce::TextButton::buttonColourId, backg_5);
+			Button_audition.setColour(juce::TextButton::buttonOnColourId, backg_3);
+			Button_audition.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
+			Button_audition.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
+			Button_audition.addListener(this);
+
+			//内部のトランスポートのテンポ
+			addAndMakeVisible(auditionTempoSlider);
+			auditionTempoSlider.setSliderStyle(Slider::IncDecButtons);
+			auditionTempoSlider.setTextBoxStyle(Slider::TextBoxLeft, false, 40, 20);
+			auditionTempoSlider.setRange(InternalTransport::minTempo, InternalTransport::maxTempo, 1.0);
+			auditionTempoSlider.setValue(owner.internalTransport.getTempo(), dontSendNotification);
+			auditionTempoSlider.setColour(Slider::textBoxTextColourId, juce::Colours::black);
+			auditionTempoSlider.onValueChange = [this] { getProcessor().internalTransport.setTempo(auditionTempoSlider.getValue()); };
+
+			addAndMakeVisible(Button_cache);
+			Button_cache.setButtonText("Cache");
+			Button_cache.setClickingTogglesState(true);
+			Button_cache.setToggleState(owner.isRenderCacheEnabled(), dontSendNotification);
+			Button_cache.setColour(juce::TextButton::buttonColourId, backg_5);
+			Button_cache.setColour(juce::TextButton::buttonOnColourId, backg_3);
+			Button_cache.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
+			Button_cache.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
+			Button_cache.addListener(this);
+
+
+
+			toneLabel.setFont(Font(Font::getDefaultMonospacedFontName(), 15.0f, Font::plain));
+			toneLabel.setColour(juce::Label::textColourId, juce::Colours::black);
+			updateToneLavel();
+			addAndMakeVisible(toneLabel);
+
+
+			keyLabel.setFont(Font(Font::getDefaultMonospacedFontName(), 15.0f, Font::plain));
+			keyLabel.setColour(juce::Label::textColourId, juce::Colours::black);
+			updatePitchLavel();
+			addAndMakeVisible(keyLabel);
+			/*
+			addAndMakeVisible(Button_key);
+			Button_key.addListener(this);
+
+			//addAndMakeVisible(Button_tone);
+			Button_tone.addListener(this);
+			*/
+
+			
+		
+
+
+			addAndMakeVisible(tempoDisplayLabel);
+			TempoLabel.setFont(Font(Font::getDefaultMonospacedFontName(), 15.0f, Font::plain));
+			TempoLabel.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
+
+
+
+			// add the midi keyboard component..
+			addAndMakeVisible(midiKeyboard);
+			midiKeyboard.setAvailableRange(24,107);
+
+			// add a label that will display the current timecode and status..
+			addAndMakeVisible(timecodeDisplayLabel);
+			timecodeDisplayLabel.setFont(Font(Font::getDefaultMonospacedFontName(), 15.0f, Font::plain));
+
+			// set resize limits for this plug-in
+			//レイアウトは800x600を基準に縦横同じ倍率で拡大するので、縦横比を固定する
+			setResizable(true, true);
+			setResizeLimits(designWidth, designHeight, designWidth * 4, designHeight * 4);
+			getConstrainer()->setFixedAspectRatio(designWidth / (double)designHeight);
+
+			//背景は全面を塗りつぶすので、親の再描画を省けるよう不透明にする
+			setOpaque(true);
+
+			//元に戻す/やり直すのショートカットを受け取る(フォーカスはホストのウィンドウに表示されたときに取る)
+			setWantsKeyboardFocus(true);
+
+			lastUIWidth.referTo(owner.state.state.getChildWithName("uiState").getPropertyAsValue("width", nullptr));
+			lastUIHeight.referTo(owner.state.state.getChildWithName("uiState").getPropertyAsValue("height", nullptr));
+
+			// set our component's initial size to be the last one that was stored in the filter's settings
+			restoreStoredSize();
+
+			lastUIWidth.addListener(this);
+			lastUIHeight.addListener(this);
+
+
+
+
+			updateTrackProperties();
+
+			// start a timer which will keep our timecode display updated
+			startTimerHz(30);
+		}
+
+		~JuceDemoPluginAudioProcessorEditor() override
+		{
+			//メーターがなくなるので収集スレッドも止める(ログを書いていれば閉じる)
+			getProcessor().telemetry.stopCollecting();
+		}
+
+		//==============================================================================
+	   //背景の描画
+		void paint(Graphics& g) override
+		{
+			auto paintStart = Time::getHighResolutionTicks();
+
+			//背景はサイズと表示倍率ごとに一度だけデコード・拡縮し、以降は保持した画像を転送するだけにする
+			auto scale = g.getInternalContext().getPhysicalPixelScaleFactor();
+			bool rebuilt = false;
+
+			if (backgroundCache.isNull() || backgroundCacheSize != getLocalBounds().getBottomRight() || backgroundCacheScale != jmax(1.0f, scale))
+			{
+				renderBackgroundCache(scale);
+				rebuilt = true;
+			}
+
+			g.drawImageTransformed(backgroundCache, AffineTransform::scale(1.0f / backgroundCacheScale));
+
+			paintTiming.addSample(Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - paintStart) * 1000.0, rebuilt);
+		}
+
+		//静的な層（塗りつぶし＋背景画像）を物理ピクセル解像度で保持画像に描き込む
+		void renderBackgroundCache(float scale)
+		{
+			backgroundCacheSize = getLocalBounds().getBottomRight();
+			backgroundCacheScale = jmax(1.0f, scale);
+
+			backgroundCache = Image(Image::RGB,
+				jmax(1, roundToInt(getWidth() * backgroundCacheScale)),
+				jmax(1, roundToInt(getHeight() * backgroundCacheScale)),
+				false);
+
+			Graphics cg(backgroundCache);
+			cg.addTransform(AffineTransform::scale(backgroundCacheScale));
+			cg.setImageResamplingQuality(Graphics::highResamplingQuality);
+			cg.fillAll();
+
+			//Imageオブジェクトの生成（デコード済みの画像はImageCacheが保持する）
+			image_background = ImageCache::getFromMemory(BinaryData::bg_jpg, BinaryData::bg_jpgSize);
+
+			//Imageオブジェクトの描画
+			cg.drawImageWithin(image_background, 0, 0, roundToInt(image_background.getWidth() * layoutScale), roundToInt(image_background.getHeight() * layoutScale), RectanglePlacement::yTop, false);
+		}
+
+		//paint()の所要時間。作り直し（旧来の毎回デコード・拡縮と同じ処理）と保持画像の転送を分けて集計する
+		struct PaintTiming
+		{
+			double rebuildTotalMs = 0, blitTotalMs = 0, worstBlitMs = 0;
+			int numRebuilds = 0, numBlits = 0;
+
+			void addSample(double ms, bool rebuilt)
+			{
+				if (rebuilt)
+				{
+					rebuildTotalMs += ms;
+					++numRebuilds;
+				}
+				else
+				{
+					blitTotalMs += ms;
+					worstBlitMs = jmax(worstBlitMs, ms);
+					++numBlits;
+				}
+			}
+
+			String getDescription() const
+			{
+				return "paint: rebuild " + String(numRebuilds > 0 ? rebuildTotalMs / numRebuilds : 0.0, 3) + " ms avg ("
+					+ String(numRebuilds) + "), cached " + String(numBlits > 0 ? blitTotalMs / numBlits : 0.0, 3) + " ms avg / "
+					+ String(worstBlitMs, 3) + " ms worst (" + String(numBlits) + ")";
+			}
+		};
+
+		const PaintTiming& getPaintTiming() const noexcept { return paintTiming; }
+
+		//ボタンなどの描画
+		void resized() override
+		{
+			// This lays out our child components...
+			//配置は大きさが変わったときだけ計算し直し、それ以外は保持した矩形を当てはめるだけにする
+			if (layoutSize != getLocalBounds().getBottomRight())
+				computeLayout();
+
+			for (auto& item : layout)
+				item.first->setBounds(item.second);
+
+			midiKeyboard.setKeyWidth(defaultKeyWidth * layoutScale);
+
+			Font labelFont(Font::getDefaultMonospacedFontName(), 15.0f * layoutScale, Font::plain);
+			keyLabel.setFont(labelFont);
+			toneLabel.setFont(labelFont);
+			timecodeDisplayLabel.setFont(labelFont);
+
+			lastUIWidth = getWidth();
+			lastUIHeight = getHeight();
+		}
+
+		//800x600の基準座標で並べ、今の大きさに合わせて拡大した矩形をlayoutに溜める
+		void computeLayout()
+		{
+			layoutSize = getLocalBounds().getBottomRight();
+			layoutScale = jmin(getWidth() / (float)designWidth, getHeight() / (float)designHeight);
+			layout.clear();
+
+			auto place = [this](Component& c, Rectangle<int> designBounds)
+			{
+				layout.push_back({ &c, designBounds.toFloat().transformedBy(AffineTransform::scale(layoutScale)).toNearestInt() });
+			};
+
+			auto r = Rectangle<int>(designWidth, designHeight).reduced(8);
+
+			//ヘッダ部分
+			auto headerArea = r.removeFromTop(75);
+			place(Button_export, headerArea.removeFromRight(60).reduced(0, 22));
+			headerArea.removeFromRight(8);
+			place(midiDragSource, headerArea.removeFromRight(60).reduced(0, 22));
+			headerArea.removeFromRight(8);
+			place(Button_cache, headerArea.removeFromRight(60).reduced(0, 22));
+			headerArea.removeFromRight(8);
+			place(auditionTempoSlider, headerArea.removeFromRight(100).reduced(0, 22));
+			place(Button_audition, headerArea.removeFromRight(60).reduced(0, 22));
+
+			place(presetSearchBox, headerArea.removeFromLeft(130).reduced(0, 22));
+			headerArea.removeFromLeft(4);
+			place(presetResults, headerArea.removeFromLeft(140).reduced(0, 22));
+			headerArea.removeFromLeft(4);
+			place(Button_savePreset, headerArea.removeFromLeft(50).reduced(0, 22));
+			headerArea.removeFromLeft(4);
+			place(Button_undo, headerArea.removeFromLeft(44).reduced(0, 22));
+			place(Button_redo, headerArea.removeFromLeft(44).reduced(0, 22));
+
+
+			//鍵盤部分
+			auto scoreArea = r.removeFromTop(170);
+			place(midiKeyboard, scoreArea.removeFromLeft(scoreArea.getWidth()));
+
+			auto marginA = r.removeFromTop(15);
+
+			//左右のボタン
+			auto sideWidth = 30;
+			place(Button_L, r.removeFromLeft(sideWidth));
+			place(Button_R, r.removeFromRight(sideWidth));
+
+
+
+
+			//コードと奏法の表(上段70px、間20px、下段30px)
+			place(progressionGrid, r.removeFromTop(120));
+
+
+			//ピアノロール
+			place(pianoRoll, r.removeFromTop(65).reduced(0, 6));
+			place(telemetryMeter, r.removeFromBottom(18));
+
+			//ジャンル部分
+			auto genreArea = r.removeFromLeft(r.getWidth() / 2);
+			auto marginC = genreArea.removeFromLeft(20);
+			auto marginD = genreArea.removeFromRight(60);
+			auto genrerow1 = genreArea.removeFromTop(genreArea.getHeight() / 2);
+			auto genrerow2 = genreArea.removeFromTop(genreArea.getHeight() / 1);
+			place(Button_g1, genrerow1.removeFromLeft(genrerow1.getWidth() / 4));
+			place(Button_g2, genrerow1.removeFromLeft(genrerow1.getWidth() / 3));
+			place(Button_g3, genrerow1.removeFromLeft(genrerow1.getWidth() / 2));
+			place(Button_g4, genrerow1.removeFromLeft(genrerow1.getWidth() / 1));
+			place(Button_g5, genrerow2.removeFromLeft(genrerow2.getWidth() / 4));
+			place(Button_g6, genrerow2.removeFromLeft(genrerow2.getWidth() / 3));
+			place(Button_g7, genrerow2.removeFromLeft(genrerow2.getWidth() / 2));
+			place(Button_g8, genrerow2.removeFromLeft(genrerow2.getWidth() / 1));
+
+
+			//設定
+			auto stateArea = r.removeFromLeft(r.getWidth() / 1);
+			auto marginE = stateArea.removeFromLeft(80);
+			auto marginF = stateArea.removeFromRight(20);
+			auto staterow1 = stateArea.removeFromTop(stateArea.getHeight() / 2);
+			auto staterow2 = stateArea.removeFromTop(stateArea.getHeight());
+
+			place(keyLabel, staterow1.removeFromLeft(staterow1.getWidth()/2));
+			place(Button_keyL, staterow1.removeFromLeft(staterow1.getWidth()/2));
+			place(Button_keyR, staterow1.removeFromLeft(staterow1.getWidth()/1));
+
+			place(toneLabel, staterow2.removeFromLeft(staterow2.getWidth() / 2));
+			place(Button_toneL, staterow2.removeFromLeft(staterow2.getWidth() / 2));
+			place(Button_toneR, staterow2.removeFromLeft(staterow2.getWidth() / 1));
+
+
+			//Button_key.setBounds(staterow1.removeFromLeft(staterow1.getWidth() / 1));
+
+			//Button_tone.setBounds(staterow2.removeFromLeft(staterow2.getWidth() / 1));
+			
+			
+			//timecodeDisplayLabel.setBounds(staterow1.removeFromLeft(staterow1.getWidth()));
+			//tempoDisplayLabel.setBounds(staterow2.removeFromLeft(staterow2.getWidth()));
+
+			auto sliderArea = r.removeFromTop(60);
+		}
+
+		void timerCallback() override
+		{
+			//再生状態が変わったときだけ表示を作り直す
+			if (getProcessor().pollAudioStatus()) {
+				updateTimecodeDisplay(getProcessor().getAudioStatus());
+				pianoRoll.setTimeSigNumerator(getProcessor().getAudioStatus().position.timeSigNumerator);
+			}
+
+			telemetryMeter.update();
+
+			//描画時間は1秒ごとに渡す(表示がオンのときだけメーターが描き直す)
+			if (++paintTimingTicks >= 30) {
+				paintTimingTicks = 0;
+				telemetryMeter.setPaintTimingText(paintTiming.getDescription());
+			}
+			midiKeyboard.setSoundingNotes(getProcessor().getSoundingNotes());
+
+			//プレイヘッドはatomicを1つ読むだけで、動いたときだけ該当セルを描き直す
+			auto playhead = getProcessor().getPlayhead();
+			progressionGrid.setPlayhead(playhead.bar, playhead.step, playhead.stepsPerBar);
+			pianoRoll.setPlayhead(playhead.bar, playhead.step, playhead.stepsPerBar);
+
+			Button_export.setEnabled(!getProcessor().isExportingAudio());
+			Button_undo.setEnabled(getProcessor().canUndoProgression());
+			Button_redo.setEnabled(getProcessor().canRedoProgression());
+
+			//索引が作り直されたら検索し直す
+			if (presetDatabase->getSnapshot() != presetSnapshot)
+				updatePresetResults();
+		}
+
+		void hostMIDIControllerIsAvailable(bool controllerIsAvailable) override
+		{
+			midiKeyboard.setVisible(!controllerIsAvailable);
+		}
+
+		int getControlParameterIndex(Component& control) override
+		{
+			if (&control == &gainSlider)
+				return 0;
+
+			if (&control == &delaySlider)
+				return 1;
+
+			return -1;
+		}
+
+		//ボタンをクリックしたときの処理
+		void buttonClicked(Button* clickedButton) override
+		{
+			int number;
+
+			number = 0;
+			if (clickedButton == &Button_g1) {
+				g_push[number] = updateChordValue(number, g_push[number]);
+			}
+
+			number++;
+			if (clickedButton == &Button_g2) {
+				g_push[number] = updateChordValue(number, g_push[number]);
+			}
+
+			number++;
+			if (clickedButton == &Button_g3) {
+				g_push[number] = updateChordValue(number, g_push[number]);
+			}
+
+			number++;
+			if (clickedButton == &Button_g4) {
+				g_push[number] = updateChordValue(number, g_push[number]);
+			}
+
+			number++;
+			if (clickedButton == &Button_g5) {
+				g_push[number] = updateChordValue(number, g_push[number]);
+			}
+
+			number++;
+			if (clickedButton == &Button_g6) {
+				g_push[number] = updateChordValue(number, g_push[number]);
+			}
+
+			number++;
+			if (clickedButton == &Button_g7) {
+				g_push[number] = updateChordValue(number, g_push[number]);
+			}
+
+			number++;
+			if (clickedButton == &Button_g8) {
+				g_push[number] = updateChordValue(number, g_push[number]);
+			}
+
+			if (clickedButton == &Button_L) {
+				progressionGrid.scrollBy(-progressionGrid.getVisibleBars());
+			}
+
+			if (clickedButton == &Button_R) {
+				progressionGrid.scrollBy(progressionGrid.getVisibleBars());
+			}
+
+			if (clickedButton == &Button_keyL && progression.getPitch() != ChordProgression::minPitch) {
+				progression.setPitch(progression.getPitch() - 1);
+				getProcessor().commitProgression();
+				updatePitchLavel();
+			}
+
+			if (clickedButton == &Button_keyR && progression.getPitch() != ChordProgression::maxPitch) {
+				progression.setPitch(progression.getPitch() + 1);
+				getProcessor().commitProgression();
+				updatePitchLavel();
+				
+			}
+
+			if (clickedButton == &Button_toneL && progression.getTone() != 0) {
+				progression.setTone(progression.getTone() - 1);
+				getProcessor().commitProgression();
+				updateToneLavel();
+			}
+
+			if (clickedButton == &Button_toneR && progression.getTone() != ChordProgression::numTones - 1) {
+				progression.setTone(progression.getTone() + 1);
+				getProcessor().commitProgression();
+				updateToneLavel();
+			}
+
+			if (clickedButton == &Button_export) {
+				getProcessor().exportAudio();
+			}
+
+			if (clickedButton == &Button_undo && getProcessor().undoProgression()) {
+				updateProgressionDisplay();
+			}
+
+			if (clickedButton == &Button_redo && getProcessor().redoProgression()) {
+				updateProgressionDisplay();
+			}
+
+			if (clickedButton == &Button_savePreset) {
+				savePreset();
+			}
+
+			if (clickedButton == &Button_audition) {
+				getProcessor().setAuditionEnabled(Button_audition.getToggleState());
+			}
+
+			if (clickedButton == &Button_cache) {
+				getProcessor().setRenderCacheEnabled(Button_cache.getToggleState());
+			}
+
+
+
+		}
+
+		//コンストラクタの時点ではまだ画面に出ていないので、ホストのウィンドウに入って表示されたらフォーカスを取る
+		void parentHierarchyChanged() override { grabFocusWhenShowing(); }
+		void visibilityChanged() override { grabFocusWhenShowing(); }
+
+		void grabFocusWhenShowing()
+		{
+			if (isShowing() && !hasKeyboardFocus(true))
+				grabKeyboardFocus();
+		}
+
+		//Ctrl(Command)+Zで元に戻す、Shift+Ctrl+ZかCtrl+Yでやり直す
+		bool keyPressed(const KeyPress& key) override
+		{
+			auto isUndo = key == KeyPress('z', ModifierKeys::commandModifier, 0);
+			auto isRedo = key == KeyPress('z', ModifierKeys::commandModifier | ModifierKeys::shiftModifier, 0)
+				|| key == KeyPress('y', ModifierKeys::commandModifier, 0);
+
+			if (!isUndo && !isRedo)
+				return false;
+
+			if (isUndo ? getProcessor().undoProgression() : getProcessor().redoProgression())
+				updateProgressionDisplay();
+
+			return true;
+		}
+
+		//MIDIファイルをエディタにドロップするとコード進行として読み込む
+		bool isInterestedInFileDrag(const StringArray& files) override
+		{
+			for (auto& f : files)
+				if (File(f).hasFileExtension("mid;midi;smf;rmi"))
+					return true;
+
+			return false;
+		}
+
+		void filesDropped(const StringArray& files, int, int) override
+		{
+			for (auto& f : files) {
+				File file(f);
+
+				if (file.hasFileExtension("mid;midi;smf;rmi") && getProcessor().importMidi(file)) {
+					progressionGrid.jumpTo(0);
+					refreshProgressionViews();
+					return;
+				}
+			}
+		}
+
+		//検索欄の語でプリセットを探し、候補に並べる(索引のスナップショットを走査するだけなのでロックしない)
+		void updatePresetResults()
+		{
+			static constexpr int maxPresetResults = 200;
+
+			presetSnapshot = presetDatabase->getSnapshot();
+			presetMatches = PresetDatabase::search(*presetSnapshot, presetSearchBox.getText(), maxPresetResults);
+
+			presetResults.clear(dontSendNotification);
+
+			for (int i = 0; i < (int)presetMatches.size(); i++) {
+				auto& preset = presetMatches[(size_t)i]->preset;
+				presetResults.addItem(preset.genre.isEmpty() ? preset.name : preset.name + " (" + preset.genre + ")", i + 1);
+			}
+		}
+
+		void loadSelectedPreset()
+		{
+			auto index = presetResults.getSelectedItemIndex();
+
+			if (!isPositiveAndBelow(index, (int)presetMatches.size()))
+				return;
+
+			getProcessor().loadPreset(presetMatches[(size_t)index]->preset);
+			progressionGrid.jumpTo(0);
+			updateProgressionDisplay();
+		}
+
+		//検索欄の文字をプリセットの名前にする。#で始まる語はタグ
+		void savePreset()
+		{
+			StringArray words, tags;
+
+			for (auto& word : StringArray::fromTokens(presetSearchBox.getText(), " ", "\""))
+				if (word.startsWithChar('#') && word.length() > 1)
+					tags.add(word.substring(1));
+				else if (word.isNotEmpty())
+					words.add(word);
+
+			presetDatabase->savePreset(getProcessor().createPreset(words.joinIntoString(" "), currentGenre, tags));
+		}
+
+		//コード進行を映す表とピアノロールを、変わった小節の分だけ更新する
+		void refreshProgressionViews() {
+			progressionGrid.refresh();
+			pianoRoll.refresh();
+		}
+
+		//状態の読み込みなどでコード進行がまとめて変わったときの表示の更新
+		void updateProgressionDisplay() {
+			updatePitchLavel();
+			updateToneLavel();
+		}
+
+		//キーの変更処理
+		void updatePitchLavel() {
+			MemoryOutputStream Text;
+
+			Text <<  "Key:" << Chord_Name[(progression.getPitch()+12)%12] << String::formatted("(%d)", progression.getPitch());
+			keyLabel.setText(Text.toString(), dontSendNotification);
+			refreshProgressionViews();
+
+		}
+		//音色の変更処理(未実装)
+		void updateToneLavel() {
+			MemoryOutputStream Text;
+			String inst[5] = { "Piano","Guitor","Synth","Strings","Bit" };
+			Text << "Tone:" <<  inst[progression.getTone()]; //String::formatted("Key:%d", Pitch);
+			toneLabel.setText(Text.toString(), dontSendNotification);
+
+
+		}
+
+
+		void updateTrackProperties()
+		{
+			auto trackColour = getProcessor().getTrackProperties().colour;
+			auto& lf = getLookAndFeel();
+
+			backgroundColour = (trackColour == Colour() ? lf.findColour(ResizableWindow::backgroundColourId)
+				: trackColour.withAlpha(1.0f).withBrightness(0.266f));
+			repaint();
+		}
+
+		//コードの値の更新
+		int updateChordValue(int n, int push) {
+			if (push == 0) {
+				push++;
+				n = 2 * n;
+			}
+			else {
+				push--;
+				n = 2 * n + 1;
+
+			}
+
+			progression.loadGenrePreset(n);
+			getProcessor().commitProgression();
+			currentGenre = Genre_Name[n / 2];
+
+			refreshProgressionViews();
+
+
+			return push;
+		}
+
+		//コードの値の更新
+		void updatePattern(int n, int push) {
+
+
+
+			progression.setPattern(n, (push + 1) % ChordProgression::numPatterns);
+			getProcessor().commitProgression();
+
+			refreshProgressionViews();
+
+
+		}
+
+
+		float mod(float a, float b){
+			return a - std::floor(a / b) * b;
+		}
+
+
+
+
+	private:
+
+		Label timecodeDisplayLabel, tempoDisplayLabel;
+
+		//使用コンポーネントの宣言
+		NoteStateKeyboard midiKeyboard;
+		Label TempoLabel;
+		Slider gainSlider, delaySlider;
+		TextButton Button_g1;
+		TextButton Button_g2;
+		TextButton Button_g3;
+		TextButton Button_g4;
+		TextButton Button_g5;
+		TextButton Button_g6;
+		TextButton Button_g7;
+		TextButton Button_g8;
+		TextButton Button_L;
+		TextButton Button_R;
+		TextButton Button_keyL;
+		TextButton Button_keyR;
+		TextButton Button_toneL;
+		TextButton Button_toneR;
+		TextButton Button_export;
+		TextButton Button_cache;
+		TextButton Button_audition;
+		Slider auditionTempoSlider;
+
+		TextEditor presetSearchBox;
+		ComboBox presetResults;
+		TextButton Button_savePreset;
+		TextButton Button_undo, Button_redo;
+
+		//ユーザーのプリセット。索引を作るスレッドを持つので、画面を開いているインスタンスだけで共有する
+		SharedResourcePointer<PresetDatabase> presetDatabase;
+		std::shared_ptr<const PresetDatabase::Snapshot> presetSnapshot;
+		std::vector<const PresetDatabase::Entry*> presetMatches;
+		FileDragSource midiDragSource{ "MIDI" };
+		Label keyLabel;
+		Label toneLabel;
+
+
+		
+
+
+		
+
+
+		//レイアウトの基準の大きさと、今の大きさでの各部品の矩形
+		static constexpr int designWidth = 800, designHeight = 600;
+		static constexpr float defaultKeyWidth = 16.0f;
+		std::vector<std::pair<Component*, Rectangle<int>>> layout;
+		Point<int> layoutSize;
+		float layoutScale = 1.0f;
+
+		Image image_background;
+		Image backgroundCache;
+		Point<int> backgroundCacheSize;
+		float backgroundCacheScale = 1.0f;
+		PaintTiming paintTiming;
+		int paintTimingTicks = 0;
+
+		int midiChannel = 10;
+		double startTime;
+
+		AudioProcessorValueTreeState::SliderAttachment gainAttachment, delayAttachment;
+		Colour backgroundColour;
+
+		// these are used to persist the UI's size - the values are stored along with the
+		// filter's other parameters, and the UI component will update them when it gets
+		// resized.
+		Value lastUIWidth, lastUIHeight;
+
+		// the progression owned by the processor
+		ChordProgression& progression;
+
+		//全小節のコードと奏法の表
+		ProgressionGrid progressionGrid{ progression, Chord_Name, Chord_Type, Pattern_Name };
+
+		//全小節で鳴るノートのピアノロール
+		PianoRollView pianoRoll{ progression };
+
+		TelemetryMeter telemetryMeter;
+
+		//==============================================================================
+		JuceDemoPluginAudioProcessor& getProcessor() const
+		{
+			return static_cast<JuceDemoPluginAudioProcessor&> (processor);
+		}
+
+		//==============================================================================
+		// quick-and-dirty function to format a timecode string
+		static String timeToTimecodeString(double seconds)
+		{
+			auto millisecs = roundToInt(seconds * 1000.0);
+			auto absMillisecs = std::abs(millisecs);
+
+			return String::formatted("%02d:%02d:%02d.%03d",
+				millisecs / 3600000,
+				(absMillisecs / 60000) % 60,
+				(absMillisecs / 1000) % 60,
+				absMillisecs % 1000);
+		}
+
+		// quick-and-dirty function to format a bars/beats string
+		static String quarterNotePositionToBarsBeatsString(double quarterNotes, int numerator, int denominator)
+		{
+			if (numerator == 0 || denominator == 0)
+				return "1|1|000";
+
+			auto quarterNotesPerBar = (numerator * 4 / denominator);
+			auto beats = (fmod(quarterNotes, quarterNotesPerBar) / quarterNotesPerBar) * numerator;
+
+			auto bar = ((((int)quarterNotes) / quarterNotesPerBar)% 8) + 1;
+			auto beat = ((int)beats) + 1;
+			auto ticks = ((int)(fmod(beats, 1.0) * 960.0 + 0.5));
+
+			return String::formatted("%d|%d|%03d", bar, beat, ticks);
+		}
+
+		// Updates the text in our position label.
+		void updateTimecodeDisplay(const AudioStatusChannel::Status& status)
+		{
+			auto& pos = status.position;
+			MemoryOutputStream displayText;
+			MemoryOutputStream displayText2; //ƒeƒ“ƒ|
+
+			displayText << pos.timeSigNumerator << '/' << pos.timeSigDenominator
+				<< "  -  " << timeToTimecodeString(pos.timeInSeconds)
+				<< "  -  " << quarterNotePositionToBarsBeatsString(pos.ppqPosition,
+					pos.timeSigNumerator,
+					pos.timeSigDenominator);
+			displayText2 << " Tempo: " << String(pos.bpm, 2) << "  Voices: " << status.numVoices;
+
+			if (pos.isRecording)
+				displayText << "  (record)";
+			else if (pos.isPlaying)
+				displayText << "  (play)";
+
+			timecodeDisplayLabel.setText(displayText.toString(), dontSendNotification);
+			tempoDisplayLabel.setText(displayText2.toString(), dontSendNotification);
+		}
+
+		// called when the stored window size changes
+		void valueChanged(Value&) override
+		{
+			restoreStoredSize();
+		}
+
+		//保存されている大きさを制限内に収めて適用する(縦横比は幅に合わせる)
+		void restoreStoredSize()
+		{
+			auto width = jlimit(designWidth, designWidth * 4, (int)lastUIWidth.getValue());
+			setSize(width, roundToInt(width * designHeight / (double)designWidth));
+		}
+	};
+
+	//==============================================================================
+
+
+	template <typename FloatType>
+	void applyGain(AudioBuffer<FloatType>& buffer, AudioBuffer<FloatType>& delayBuffer, int startSample, int numSamples, float startGain, float endGain)
+	{
+		ignoreUnused(delayBuffer);
+
+		for (auto channel = 0; channel < getTotalNumOutputChannels(); ++channel)
+		{
+			if (startGain == endGain)
+				buffer.applyGain(channel, startSample, numSamples, (FloatType)startGain);
+			else
+				buffer.applyGainRamp(channel, startSample, numSamples, (FloatType)startGain, (FloatType)endGain);
+		}
+	}
+
+	//リングバッファを折り返し位置で最大2つの連続区間に分けて処理するので、
+	//サンプルごとの折り返し判定がない
+	template <typename FloatType>
+	void applyDelay(AudioBuffer<FloatType>& buffer, AudioBuffer<FloatType>& delayBuffer, int startSample, int numSamples, float startLevel, float endLevel)
+	{
+		auto delayLength = delayBuffer.getNumSamples();
+
+		if (delayLength <= 1 || numSamples == 0)
+			return;
+
+		auto levelStep = (FloatType)(endLevel - startLevel) / (FloatType)numSamples;
+		auto delayPos = 0;
+
+		for (auto channel = 0; channel < getTotalNumOutputChannels(); ++channel)
+		{
+			auto channelData = buffer.getWritePointer(channel, startSample);
+			auto delayData = delayBuffer.getWritePointer(jmin(channel, delayBuffer.getNumChannels() - 1));
+			delayPos = delayPosition;
+
+			for (auto done = 0; done < numSamples;)
+			{
+				auto span = jmin(numSamples - done, delayLength - delayPos);
+				auto* out = channelData + done;
+				auto* delayed = delayData + delayPos;
+				auto level = (FloatType)startLevel + levelStep * (FloatType)done;
+
+				// out = in + delayed, delayed = (delayed + in) * level = out * level
+				FloatVectorOperations::add(out, delayed, span);
+
+				if (levelStep == 0)
+					FloatVectorOperations::copyWithMultiply(delayed, out, level, span);
+				else
+					for (auto i = 0; i < span; ++i)
+						delayed[i] = out[i] * (level + levelStep * (FloatType)i);
+
+				done += span;
+				delayPos += span;
+
+				if (delayPos == delayLength)
+					delayPos = 0;
+			}
+		}
+
+		delayPosition = delayPos;
+	}
+
+	static constexpr int delayBufferLength = 12000;
+	static constexpr float silenceThreshold = 1.0e-5f; // -100dB
+
+	AudioBuffer<float> delayBufferFloat;
+	AudioBuffer<double> delayBufferDouble;
+
+	int delayPosition = 0;
+	//オートメーションのランプ時間
+	static constexpr double automationRampSeconds = 0.01;
+	AutomatedParameter gainAutomation, delayAutomation;
+
+	ChordStepEngine::Cursor stepCursor;
+	bool stepNotesReleaseOnly = false;
+
+	std::atomic<bool> auditionEnabled{ false };
+	bool usingInternalTransport = false;
+
+	AudioStatusChannel statusChannel;
+	std::atomic<int> playheadPosition{ -1 };
+
+	//オーディオスレッドに渡したコード進行。差し替えはポインタ1つのatomicなstoreで行う。
+	//オーディオスレッドは使っている版をprogressionInUseで知らせ(ハザードポインタ)、
+	//メッセージスレッドはそれ以外の古い版だけを解放する
+	ProgressionHistory history;
+	std::unique_ptr<const ChordProgression> publishedOwner;
+	std::vector<std::unique_ptr<const ChordProgression>> retiredProgressions;
+	std::atomic<const ChordProgression*> publishedProgression{ nullptr };
+	std::atomic<const ChordProgression*> progressionInUse{ nullptr };
+	const ChordProgression* playingProgression = nullptr;
+
+	//進行と履歴を書くのはメッセージスレッドだけ(チャンクのコピーオンライトは書き手が1つのスレッドである前提)
+	void publishProgression()
+	{
+		jassert(MessageManager::existsAndIsCurrentThread());
+		publishCurrentProgression();
+	}
+
+	void publishCurrentProgression()
+	{
+		std::unique_ptr<const ChordProgression> next(new ChordProgression(progression));
+		publishedProgression.store(next.get());
+
+		if (publishedOwner != nullptr)
+			retiredProgressions.push_back(std::move(publishedOwner));
+
+		publishedOwner = std::move(next);
+
+		auto inUse = progressionInUse.load();
+		retiredProgressions.erase(std::remove_if(retiredProgressions.begin(), retiredProgressions.end(),
+			[inUse](const std::unique_ptr<const ChordProgression>& p) { return p.get() != inUse; }),
+			retiredProgressions.end());
+	}
+
+	const ChordProgression& acquirePublishedProgression() noexcept
+	{
+		const ChordProgression* current;
+
+		do {
+			current = publishedProgression.load();
+			progressionInUse.store(current);
+		} while (current != publishedProgression.load());
+
+		return *current;
+	}
+
+	File sampleFile; //読み込んだサンプルのファイル(内蔵のピアノなら空)
+	File midiDragFile; //MIDIをドラッグするときに書き出す一時ファイル(最初のドラッグで決める)
+
+	//小節のレンダリング結果のキャッシュと、そこから鳴らしている小節
+	struct PlayingBar
+	{
+		BarRenderCache::Entry::Ptr entry;
+		int position = 0;       //次に読む位置(負ならブロックのその位置から始まる)
+		int fadeRemaining = 0;
+		bool wasInterrupted = false;
+	};
+
+	static constexpr int maxPlayingBars = 16;
+	static constexpr double cachedBarFadeSeconds = 0.005;
+
+	std::unique_ptr<BarRenderCache> renderCache;
+	PlayingBar playingBars[maxPlayingBars];
+	int numPlayingBars = 0;
+	int cachedBarFadeLength = 1;
+	bool currentBarIsCached = false;
+	int64 lastTriggeredStep = std::numeric_limits<int64>::min() + 1;
+	MidiBuffer cachedStepEvents;
+
+	//オーディオスレッドでMidiBufferを伸ばさないよう、ブロックのイベントはprepareToPlayで確保した
+	//バッファに集める(ノートオン1つが9バイトなので、1ブロック1800イベントほど)
+	static constexpr int midiBufferBytes = 16384;
+	MidiBuffer blockEvents, spareBlockEvents;
+	const uint8* ownMidiStorage[2] = {};
+
+	SharedResourcePointer<BuiltInPiano> builtInPiano;
+
+	//アイドル判定用: 続けて無音だったサンプル数
+	int silentSamples = 0;
+
+	AudioProcessLoadMeasurer loadMeasurer;
+	std::atomic<double> peakBlockLoad{ 0 };
+	std::atomic<double> totalBlockLoad{ 0 };
+	std::atomic<int64> numBlocksMeasured{ 0 };
+
+	//画面の鍵盤(メッセージスレッド)で弾いたノートはキューでオーディオスレッドに渡す
+	KeyboardEventQueue keyboardEvents;
+
+	void handleNoteOn(MidiKeyboardState*, int, int midiNoteNumber, float velocity) override { keyboardEvents.push(midiNoteNumber, velocity, true); }
+	void handleNoteOff(MidiKeyboardState*, int, int midiNoteNumber, float velocity) override { keyboardEvents.push(midiNoteNumber, velocity, false); }
+
+	//オーディオスレッドが持つ押鍵状態と、毎ブロック画面用に公開する写し
+	NoteBitmap soundingNotes;
+	PublishedNoteBitmap publishedNotes;
+
+	SamplerVoiceBank synth;
+
+	CriticalSection trackPropertiesLock;
+	TrackProperties trackProperties;
+
+	//音声の書き出しをメッセージスレッドの外で行うスレッド(書き出し中だけ存在する)
+	class AudioExportThread;
+	std::unique_ptr<Thread> audioExportThread;
+
+	void audioExportFinished(const File& file, bool succeeded);
+
+
+
+	//再生位置を取得できたらtrue。ホストのトランスポートが動いていなくて試聴がオンなら、内部のトランスポートを使う
+	bool updateCurrentTimeInfo(int numSamples)
+	{
+		AudioPlayHead::CurrentPositionInfo newTime;
+		auto hostHasPosition = false;
+
+		if (auto* ph = getPlayHead())
+			hostHasPosition = ph->getCurrentPosition(newTime);
+
+		if ((!hostHasPosition || !newTime.isPlaying) && auditionEnabled.load())
+		{
+			//内部のトランスポートに切り替わるたびに曲頭から鳴らす
+			if (!usingInternalTransport)
+				internalTransport.rewind();
+
+			usingInternalTransport = true;
+			internalTransport.getPositionAndAdvance(lastPosInfo, numSamples);
+			return true;
+		}
+
+		usingInternalTransport = false;
+
+		if (hostHasPosition)
+		{
+			lastPosInfo = newTime;  // Successfully got the current time from the host..
+			return true;
+		}
+
+		// If the host fails to provide the current time, we'll just reset our copy to a default..
+		lastPosInfo.resetToDefault();
+		return false;
+	}
+
+	static BusesProperties getBusesProperties()
+	{
+		return BusesProperties().withInput("Input", AudioChannelSet::stereo(), false)
+			.withOutput("Output", AudioChannelSet::stereo(), true);
+	}
+
+	JUCE_DECLARE_WEAK_REFERENCEABLE(JuceDemoPluginAudioProcessor)
+	JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(JuceDemoPluginAudioProcessor);
+};
+
+
+//==============================================================================
+/** ホストの代わりに再生位置を与えるプレイヘッド */
+class OfflinePlayHead : public AudioPlayHead
+{
+public:
+	OfflinePlayHead() { info.resetToDefault(); }
+
+	bool getCurrentPosition(CurrentPositionInfo& result) override
+	{
+		result = info;
+		return true;
+	}
+
+	CurrentPositionInfo info;
+};
+
+
+//==============================================================================
+/** processBlockと同じエンジン(JuceDemoPluginAudioProcessor)をOfflinePlayHeadで動かし、
+	実時間より速くオーディオに書き出す。
+
+	進行をbarsPerJob小節ずつの区間に分けて別々のスレッドでレンダリングし、
+	各区間の残響ごと曲頭からの位置に足し合わせてつなぐ。区間の後の残響を描く間は
+	次の区間のノートをノートオフとして送るので、同じ音が鳴り直して切れるところも通しで
+	レンダリングした場合と同じになる。
+
+	エンジンはAudioProcessorValueTreeStateのタイマーを持つので、コンストラクタで作り
+	デストラクタで破棄する。OfflineRendererの生成と破棄はメッセージスレッドで行うこと
+	(render()とrenderToFile()はどのスレッドから呼んでもよい)。 */
+class OfflineRenderer
+{
+public:
+	struct Settings
+	{
+		double sampleRate = 44100.0;
+		int blockSize = 512;
+		double bpm = 120.0;
+		int timeSigNumerator = 4, timeSigDenominator = 4;
+		int numLoops = 1;                           // 進行を何回繰り返すか
+		int barsPerJob = 1;                         // 1つのジョブでレンダリングする小節数
+		int numThreads = SystemStats::getNumCpus();
+		double maxTailSeconds = 10.0;               // 区間の後に描く残響の上限
+		float gain = 0.9f, delay = 0.5f;
+	};
+
+	OfflineRenderer(const ChordProgression& progressionToRender, SharedSample::Ptr sampleToUse, const Settings& settingsToUse)
+		: progression(progressionToRender), sample(sampleToUse), settings(settingsToUse)
+	{
+		auto numWorkers = jlimit(1, getNumJobs(), settings.numThreads);
+
+		for (int i = 0; i < numWorkers; ++i)
+			engines.add(createEngine(progression, sample, settings).release());
+	}
+
+	//進行全体をレンダリングしてresultに入れる(長さは最後の残響が消えるまで)
+	void render(AudioBuffer<float>& result)
+	{
+		auto totalBars = getTotalBars();
+		auto barsPerJob = jmax(1, settings.barsPerJob);
+		auto numJobs = getNumJobs();
+		auto numWorkers = engines.size();
+
+		OwnedArray<AudioBuffer<float>> sections;
+		std::vector<int> lengths((size_t)numJobs, 0);
+
+		for (int i = 0; i < numJobs; ++i)
+			sections.add(new AudioBuffer<float>());
+
+		runParallelJobs(numWorkers, numJobs, [&](int worker, int job)
+			{
+				auto firstBar = job * barsPerJob;
+
+				renderSection(*engines[worker], settings, firstBar, jmin(barsPerJob, totalBars - firstBar), totalBars,
+					*sections[job], lengths[(size_t)job]);
+			});
+
+		int64 totalLength = 0;
+
+		for (int i = 0; i < numJobs; ++i)
+			totalLength = jmax(totalLength, getBarStartSample(i * barsPerJob, settings) + lengths[(size_t)i]);
+
+		result.setSize(2, (int)totalLength);
+		result.clear();
+
+		for (int i = 0; i < numJobs; ++i)
+		{
+			auto offset = (int)getBarStartSample(i * barsPerJob, settings);
+
+			for (int ch = 0; ch < result.getNumChannels(); ++ch)
+				result.addFrom(ch, offset, *sections[i], jmin(ch, sections[i]->getNumChannels() - 1), 0, lengths[(size_t)i]);
+		}
+	}
+
+	//拡張子が.flacならFLAC、それ以外はWAVで書き出す
+	bool renderToFile(const File& file)
+	{
+		AudioBuffer<float> result;
+		render(result);
+
+		return writeToFile(result, settings.sampleRate, file);
+	}
+
+	static bool writeToFile(const AudioBuffer<float>& buffer, double sampleRate, const File& file)
+	{
+		std::unique_ptr<AudioFormat> format;
+
+		if (file.hasFileExtension("flac"))
+			format.reset(new FlacAudioFormat());
+		else
+			format.reset(new WavAudioFormat());
+
+		file.deleteFile();
+		std::unique_ptr<FileOutputStream> stream(new FileOutputStream(file));
+
+		if (!stream->openedOk())
+			return false;
+
+		std::unique_ptr<AudioFormatWriter> writer(format->createWriterFor(stream.get(), sampleRate,
+			(unsigned int)buffer.getNumChannels(), 24, {}, 0));
+
+		if (writer == nullptr)
+			return false;
+
+		stream.release(); // the writer now owns the stream
+		return writer->writeFromAudioSampleBuffer(buffer, 0, buffer.getNumSamples());
+	}
+
+	//曲頭から数えたbar小節目の先頭のサンプル位置(エンジンがステップの境界に使う位置と同じ切り上げ)
+	static int64 getBarStartSample(int64 bar, const Settings& s)
+	{
+		auto samplesPerQuarter = s.sampleRate * 60.0 / s.bpm;
+		auto quarterNotesPerBar = ChordStepEngine::getQuarterNotesPerBar(s.timeSigNumerator, s.timeSigDenominator);
+
+		return (int64)std::ceil((double)bar * quarterNotesPerBar * samplesPerQuarter - 1.0e-6);
+	}
+
+	static std::unique_ptr<JuceDemoPluginAudioProcessor> createEngine(const ChordProgression& p, SharedSample::Ptr sampleToUse, const Settings& s)
+	{
+		auto engine = std::make_unique<JuceDemoPluginAudioProcessor>();
+
+		engine->setNonRealtime(true);
+		engine->setRenderProgression(p);
+
+		if (sampleToUse != nullptr)
+			engine->setupSampler(sampleToUse);
+
+		engine->state.getParameter("gain")->setValue(s.gain);
+		engine->state.getParameter("delay")->setValue(s.delay);
+		engine->setAuditionEnabled(false);
+		engine->setRateAndBufferSizeDetails(s.sampleRate, s.blockSize);
+
+		return engine;
+	}
+
+	//firstBarからnumBars小節を、残響が消えるまで(最大maxTailSeconds)レンダリングする。
+	//エンジンはprepareToPlayで毎回初期化するので、前のジョブの状態は残らない
+	static void renderSection(JuceDemoPluginAudioProcessor& engine, const Settings& s, int firstBar, int numBars, int totalBars,
+		AudioBuffer<float>& out, int& outLength)
+	{
+		auto samplesPerQuarter = s.sampleRate * 60.0 / s.bpm;
+		auto sectionStart = getBarStartSample(firstBar, s);
+		auto sectionEnd = getBarStartSample(firstBar + numBars, s);
+		auto arrangementEnd = getBarStartSample(totalBars, s);
+		auto limit = sectionEnd + (int64)(s.maxTailSeconds * s.sampleRate);
+
+		out.setSize(2, (int)(limit - sectionStart), false, false, true);
+
+		OfflinePlayHead playHead;
+		playHead.info.bpm = s.bpm;
+		playHead.info.timeSigNumerator = s.timeSigNumerator;
+		playHead.info.timeSigDenominator = s.timeSigDenominator;
+
+		engine.setPlayHead(&playHead);
+		engine.prepareToPlay(s.sampleRate, s.blockSize);
+
+		MidiBuffer midi;
+		auto t = sectionStart;
+
+		while (t < limit)
+		{
+			auto inTail = t >= sectionEnd;
+
+			if (inTail && engine.isSilent())
+				break;
+
+			auto numSamples = (int)jmin((int64)s.blockSize, (inTail ? limit : sectionEnd) - t);
+			auto& info = playHead.info;
+
+			//曲の終わりを過ぎたら最後のステップの位置で止める(新しいノートは出ない)
+			info.isPlaying = t < arrangementEnd;
+			info.timeInSamples = jmin(t, arrangementEnd - 1);
+			info.timeInSeconds = (double)info.timeInSamples / s.sampleRate;
+			info.ppqPosition = (double)info.timeInSamples / samplesPerQuarter;
+
+			engine.setStepNotesReleaseOnly(inTail);
+
+			AudioBuffer<float> block(out.getArrayOfWritePointers(), out.getNumChannels(), (int)(t - sectionStart), numSamples);
+			midi.clear();
+			engine.processBlock(block, midi);
+
+			t += numSamples;
+		}
+
+		engine.setPlayHead(nullptr);
+		engine.setStepNotesReleaseOnly(false);
+		outLength = (int)(t - sectionStart);
+	}
+
+	//numJobs個のジョブをnumWorkers個のスレッドに配る。各スレッドは共有のカーソルから
+	//次のジョブを取るので、重いジョブがあっても空いたスレッドが残りを拾う。
+	//jobにはスレッドの番号(0〜numWorkers-1)が渡るので、スレッドごとのエンジンを選べる
+	static void runParallelJobs(int numWorkers, int numJobs, const std::function<void(int worker, int job)>& job)
+	{
+		std::atomic<int> nextJob{ 0 };
+
+		auto runWorker = [&](int worker)
+		{
+			for (int i = nextJob++; i < numJobs; i = nextJob++)
+				job(worker, i);
+		};
+
+		if (numWorkers <= 1)
+		{
+			runWorker(0);
+			return;
+		}
+
+		ThreadPool pool(numWorkers - 1);
+		WaitableEvent finished;
+		std::atomic<int> remaining{ numWorkers - 1 };
+
+		for (int worker = 1; worker < numWorkers; ++worker)
+			pool.addJob([&, worker]
+				{
+					runWorker(worker);
+
+					if (--remaining == 0)
+						finished.signal();
+				});
+
+		runWorker(0);
+		finished.wait();
+	}
+
+private:
+	ChordProgression progression;
+	SharedSample::Ptr sample;
+	Settings settings;
+	OwnedArray<JuceDemoPluginAudioProcessor> engines;
+
+	int getTotalBars() const { return progression.getNumBars() * jmax(1, settings.numLoops); }
+	int getNumJobs() const { auto barsPerJob = jmax(1, settings.barsPerJob); return (getTotalBars() + barsPerJob - 1) / barsPerJob; }
+};
+
+
+//==============================================================================
+/** ジャンルのプリセット × 奏法 × キーのすべての組み合わせのプレビュー音声を書き出す。
+	(音色の設定は今のところ表示だけで音に影響しないので、組み合わせに含めない)
+
+	1つの組み合わせ(進行全体)が1ジョブで、OfflineRenderer::runParallelJobsで全コアに配る。
+	スレッドごとに専用のエンジンを持ち、ジョブの最初にprepareToPlayで初期化するので、
+	どのスレッドがどのジョブを担当しても出力はビット単位で同じになる。
+	OfflineRendererと同じく、メッセージスレッドから呼ぶこと。
+	スタンドアロンを --batch-render <directory> で起動すると、これで書き出して終了する(Main.cpp)。 */
+class ProgressionBatchRenderer
+{
+public:
+	struct Job
+	{
+		int preset, pattern, pitch;
+	};
+
+	struct Result
+	{
+		int numRenders = 0, numFailed = 0;
+		double seconds = 0.0;
+		double rendersPerSecond = 0.0;
+		double averageLoad = 0.0, peakBlockLoad = 0.0; //エンジンのブロックあたりの負荷(実時間の持ち時間に対する割合)
+	};
+
+	ProgressionBatchRenderer(SharedSample::Ptr sampleToUse, const OfflineRenderer::Settings& settingsToUse)
+		: sample(sampleToUse), settings(settingsToUse)
+	{
+	}
+
+	static int getNumJobs()
+	{
+		return ChordProgression::numGenrePresets * ChordProgression::numPatterns
+			* (ChordProgression::maxPitch - ChordProgression::minPitch + 1);
+	}
+
+	static Job getJob(int index)
+	{
+		Job job;
+		job.pitch = ChordProgression::minPitch + index % (ChordProgression::maxPitch - ChordProgression::minPitch + 1);
+		index /= (ChordProgression::maxPitch - ChordProgression::minPitch + 1);
+		job.pattern = index % ChordProgression::numPatterns;
+		job.preset = index / ChordProgression::numPatterns;
+		return job;
+	}
+
+	static ChordProgression getProgression(const Job& job)
+	{
+		ChordProgression p;
+		p.loadGenrePreset(job.preset);
+
+		for (int i = 0; i < p.getNumBars(); i++)
+			p.setPattern(i, job.pattern);
+
+		p.setPitch(job.pitch);
+		return p;
+	}
+
+	static String getFileName(const Job& job)
+	{
+		return String::formatted("g%02d_p%d_k%+03d.wav", job.preset, job.pattern, job.pitch);
+	}
 
-			addAndMakeVisible(Button_g5);
-			Button_g5.setButtonText("Idol");
-			Button_g5.setColour(juce::TextButton::buttonColourId, backg_5);
-			Button_g5.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
-			Button_g5.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
-			Button_g5.addListener(this);
+	//すべての組み合わせをoutputDirectoryに書き出し、処理量(renders/second)を返す
+	Result renderAll(const File& outputDirectory)
+	{
+		Result result;
+		auto numJobs = getNumJobs();
+		auto numWorkers = jlimit(1, numJobs, settings.numThreads);
 
-			addAndMakeVisible(Button_g6);
-			Button_g6.setButtonText("Ballade");
-			Button_g6.setColour(juce::TextButton::buttonColourId, backg_5);
-			Button_g6.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
-			Button_g6.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
-			Button_g6.addListener(this);
+		if (!outputDirectory.createDirectory())
+			return result;
 
-			addAndMakeVisible(Button_g7);
-			Button_g7.setButtonText("Anime");
-			Button_g7.setColour(juce::TextButton::buttonColourId, backg_5);
-			Button_g7.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
-			Button_g7.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
-			Button_g7.addListener(this);
+		OwnedArray<JuceDemoPluginAudioProcessor> engines;
+		OwnedArray<AudioBuffer<float>> buffers;
 
-			addAndMakeVisible(Button_g8);
-			Button_g8.setButtonText("Game");
-			Button_g8.setColour(juce::TextButton::buttonColourId, backg_5);
-			Button_g8.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
-			Button_g8.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
-			Button_g8.addListener(this);
+		for (int i = 0; i < numWorkers; ++i) {
+			engines.add(OfflineRenderer::createEngine({}, sample, settings).release());
+			buffers.add(new AudioBuffer<float>());
+		}
 
-			addAndMakeVisible(Button_L);
-			Button_L.setButtonText("<");
-			Button_L.setColour(juce::TextButton::buttonColourId, backg_5);
-			Button_L.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
-			Button_L.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
-			Button_L.addListener(this);
+		std::atomic<int> numFailed{ 0 };
+		auto startTime = Time::getMillisecondCounterHiRes();
 
-			addAndMakeVisible(Button_R);
-			Button_R.setColour(juce::TextButton::buttonColourId, backg_5);
-			Button_R.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
-			Button_R.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
-			Button_R.setButtonText(">");
-			Button_R.addListener(this);
+		OfflineRenderer::runParallelJobs(numWorkers, numJobs, [&](int worker, int index)
+			{
+				auto job = getJob(index);
+				auto& engine = *engines[worker];
+				auto& buffer = *buffers[worker];
 
-			addAndMakeVisible(Button_keyL);
-			Button_keyL.setButtonText("-");
-			Button_keyL.setColour(juce::TextButton::buttonColourId, backg_5);
-			Button_keyL.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
-			Button_keyL.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
-			Button_keyL.addListener(this);
+				engine.setRenderProgression(getProgression(job));
 
-			addAndMakeVisible(Button_keyR);
-			Button_keyR.setButtonText("+");
-			Button_keyR.setColour(juce::TextButton::buttonColourId, backg_5);
-			Button_keyR.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
-			Button_keyR.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
-			Button_keyR.addListener(this);
+				int length = 0;
+				OfflineRenderer::renderSection(engine, settings, 0, engine.progression.getNumBars(), engine.progression.getNumBars(), buffer, length);
 
-			addAndMakeVisible(Button_toneL);
-			Button_toneL.setButtonText("<");
-			Button_toneL.setColour(juce::TextButton::buttonColourId, backg_5);
-			Button_toneL.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
-			Button_toneL.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
-			Button_toneL.addListener(this);
+				AudioBuffer<float> rendered(buffer.getArrayOfWritePointers(), buffer.getNumChannels(), length);
 
-			addAndMakeVisible(Button_toneR);
-			Button_toneR.setButtonText(">");
-			Button_toneR.setColour(juce::TextButton::buttonColourId, backg_5);
-			Button_toneR.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
-			Button_toneR.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
-			Button_toneR.addListener(this);
+				if (!OfflineRenderer::writeToFile(rendered, settings.sampleRate, outputDirectory.getChildFile(getFileName(job))))
+					++numFailed;
+			});
 
+		result.seconds = (Time::getMillisecondCounterHiRes() - startTime) / 1000.0;
+		result.numRenders = numJobs;
+		result.numFailed = numFailed;
+		result.rendersPerSecond = result.seconds > 0 ? numJobs / result.seconds : 0.0;
 
+		//平均はすべてのエンジンの全ブロックの負荷から求める(なまらせた最後の値ではなく)
+		double totalLoad = 0;
+		int64 numBlocks = 0;
 
-			toneLabel.setFont(Font(Font::getDefaultMonospacedFontName(), 15.0f, Font::plain));
-			toneLabel.setColour(juce::Label::textColourId, juce::Colours::black);
-			updateToneLavel();
-			addAndMakeVisible(toneLabel);
+		for (auto* engine : engines) {
+			totalLoad += engine->getTotalBlockLoad();
+			numBlocks += engine->getNumBlocksMeasured();
+			result.peakBlockLoad = jmax(result.peakBlockLoad, engine->takePeakBlockLoad());
+		}
 
+		result.averageLoad = numBlocks > 0 ? totalLoad / (double)numBlocks : 0.0;
 
-			keyLabel.setFont(Font(Font::getDefaultMonospacedFontName(), 15.0f, Font::plain));
-			keyLabel.setColour(juce::Label::textColourId, juce::Colours::black);
-			updatePitchLavel();
-			addAndMakeVisible(keyLabel);
-			/*
-			addAndMakeVisible(Button_key);
-			Button_key.addListener(this);
+		Logger::writeToLog(String::formatted("Batch render: %d renders on %d threads in %.2f s (%.1f renders/s, block load %.1f%% avg / %.1f%% peak)",
+			numJobs, numWorkers, result.seconds, result.rendersPerSecond, result.averageLoad * 100.0, result.peakBlockLoad * 100.0));
 
-			//addAndMakeVisible(Button_tone);
-			Button_tone.addListener(this);
-			*/
+		return result;
+	}
 
-			
-		
+private:
+	SharedSample::Ptr sample;
+	OfflineRenderer::Settings settings;
+};
 
 
-			addAndMakeVisible(tempoDisplayLabel);
-			TempoLabel.setFont(Font(Font::getDefaultMonospacedFontName(), 15.0f, Font::plain));
-			TempoLabel.setColour(juce::TextButton::textColourOffId, juce::Colours::black);
+//==============================================================================
+/** Standard MIDI File(フォーマット0、1トラック)をOutputStreamへ順に書いていくライター。
+	トラックの長さは最後にfinish()でヘッダへ書き戻すので、出力先はsetPositionできること。 */
+class StreamingMidiFileWriter
+{
+public:
+	StreamingMidiFileWriter(OutputStream& stream, int ticksPerQuarterNote)
+		: out(stream)
+	{
+		out.write("MThd", 4);
+		out.writeIntBigEndian(6);
+		out.writeShortBigEndian(0);
+		out.writeShortBigEndian(1);
+		out.writeShortBigEndian((short)ticksPerQuarterNote);
+
+		out.write("MTrk", 4);
+		lengthPosition = out.getPosition();
+		out.writeIntBigEndian(0);
+		trackStart = out.getPosition();
+	}
 
+	void writeMessage(int64 tick, const MidiMessage& message)
+	{
+		writeVariableLength(jmax((int64)0, tick - lastTick));
+		lastTick = jmax(lastTick, tick);
+		out.write(message.getRawData(), (size_t)message.getRawDataSize());
+	}
 
+	bool finish(int64 endTick)
+	{
+		writeMessage(endTick, MidiMessage::endOfTrack());
 
-			// add the midi keyboard component..
-			addAndMakeVisible(midiKeyboard);
-			midiKeyboard.setAvailableRange(24,107);
+		auto end = out.getPosition();
 
-			// add a label that will display the current timecode and status..
-			addAndMakeVisible(timecodeDisplayLabel);
-			timecodeDisplayLabel.setFont(Font(Font::getDefaultMonospacedFontName(), 15.0f, Font::plain));
+		if (!out.setPosition(lengthPosition))
+			return false;
 
-			// set resize limits for this plug-in
-			setResizeLimits(800, 600, 800, 600);
+		out.writeIntBigEndian((int)(end - trackStart));
+		return out.setPosition(end);
+	}
 
-			lastUIWidth.referTo(owner.state.state.getChildWithName("uiState").getPropertyAsValue("width", nullptr));
-			lastUIHeight.referTo(owner.state.state.getChildWithName("uiState").getPropertyAsValue("height", nullptr));
+private:
+	void writeVariableLength(int64 value)
+	{
+		uint8 bytes[10];
+		int numBytes = 0;
 
-			// set our component's initial size to be the last one that was stored in the filter's settings
+		bytes[numBytes++] = (uint8)(value & 0x7f);
 
-			//setSize (lastUIWidth.getValue(), lastUIHeight.getValue());
+		while ((value >>= 7) > 0)
+			bytes[numBytes++] = (uint8)((value & 0x7f) | 0x80);
 
-			lastUIWidth.addListener(this);
-			lastUIHeight.addListener(this);
+		while (numBytes > 0)
+			out.writeByte((char)bytes[--numBytes]);
+	}
 
+	OutputStream& out;
+	int64 lengthPosition = 0, trackStart = 0, lastTick = 0;
+};
 
 
+//==============================================================================
+/** 生成したコードと奏法のノートをStandard MIDI Fileに書き出す。
 
-			updateTrackProperties();
+	ステップごとにChordStepEngine::Cursor(processBlockと同じ規則)でノートを求め、
+	その場でStreamingMidiFileWriterへ書くので、進行が長くてもMidiMessageSequenceを作らない。
+	メモリに持つのは鳴っている音の集合だけ。ノートは次に鍵盤表示がリセットされるステップか、
+	同じ音が鳴り直すところで終わる。 */
+class MidiFileExporter
+{
+public:
+	static constexpr int ticksPerQuarterNote = 960;
 
-			// start a timer which will keep our timecode display updated
-			startTimerHz(30);
-		}
+	struct Settings
+	{
+		double bpm = 120.0;
+		int timeSigNumerator = 4, timeSigDenominator = 4;
+		int numLoops = 1;
+	};
 
-		~JuceDemoPluginAudioProcessorEditor() override {}
+	static bool write(OutputStream& out, const ChordProgression& progression, const Settings& settings)
+	{
+		StreamingMidiFileWriter writer(out, ticksPerQuarterNote);
 
-		//==============================================================================
-	   //背景の描画
-		void paint(Graphics& g) override
-		{
-			//g.setColour (backgroundColour);
-			g.fillAll();
+		auto numerator = settings.timeSigNumerator;
+		auto stepLength = ChordStepEngine::getStepLength(numerator, settings.timeSigDenominator);
+		auto totalSteps = (int64)ChordStepEngine::getStepsPerBar(numerator) * progression.getNumBars() * jmax(1, settings.numLoops);
 
-			//Imageオブジェクトの生成
-			image_background = ImageCache::getFromMemory(BinaryData::bg_jpg, BinaryData::bg_jpgSize);
+		writer.writeMessage(0, MidiMessage::textMetaEvent(3, "Chord Progressor"));
+		writer.writeMessage(0, MidiMessage::tempoMetaEvent(roundToInt(60000000.0 / settings.bpm)));
+		writer.writeMessage(0, MidiMessage::timeSignatureMetaEvent(numerator, settings.timeSigDenominator));
 
-			//Imageオブジェクトの描画
-			g.drawImageWithin(image_background, 0, 0, image_background.getWidth(), image_background.getHeight(), RectanglePlacement::yTop, false);
-		}
+		bool sounding[128] = {};
+		ChordStepEngine::Cursor cursor;
 
-		//ボタンなどの描画
-		void resized() override
+		for (int64 k = 0; k < totalSteps; ++k)
 		{
-			// This lays out our child components...
+			ChordStep step;
 
+			if (!cursor.advance(progression, k, numerator, step))
+				continue;
 
+			auto tick = getTick(k, stepLength);
 
-			auto r = getLocalBounds().reduced(8);
+			if (step.clearsKeyboard)
+				releaseAll(writer, sounding, tick);
 
-			//ヘッダ部分
-			auto headerArea = r.removeFromTop(75);
+			bool startedHere[128] = {};
 
+			for (int i = 0; i < step.numNotes; i++) {
+				auto note = step.notes[i];
 
-			//鍵盤部分
-			auto scoreArea = r.removeFromTop(170);
-			midiKeyboard.setBounds(scoreArea.removeFromLeft(scoreArea.getWidth()));
+				if (!isPositiveAndBelow(note, 128) || startedHere[note])
+					continue;
 
-			auto marginA = r.removeFromTop(15);
+				if (sounding[note])
+					writer.writeMessage(tick, MidiMessage::noteOff(1, note));
 
-			//左右のボタン
-			auto sideWidth = 30;
-			Button_L.setBounds(r.removeFromLeft(sideWidth));
-			Button_R.setBounds(r.removeFromRight(sideWidth));
+				writer.writeMessage(tick, MidiMessage::noteOn(1, note, (uint8)127));
+				sounding[note] = startedHere[note] = true;
+			}
+		}
 
+		auto endTick = getTick(totalSteps, stepLength);
+		releaseAll(writer, sounding, endTick);
 
+		return writer.finish(endTick);
+	}
 
+	static bool write(const File& file, const ChordProgression& progression, const Settings& settings)
+	{
+		file.deleteFile();
+		FileOutputStream out(file);
 
-			//コード部分
-			auto chordArea = r.removeFromTop(70);
-			Button_c1.setBounds(chordArea.removeFromLeft(chordArea.getWidth() / 4));
-			Button_c2.setBounds(chordArea.removeFromLeft(chordArea.getWidth() / 3));
-			Button_c3.setBounds(chordArea.removeFromLeft(chordArea.getWidth() / 2));
-			Button_c4.setBounds(chordArea.removeFromLeft(chordArea.getWidth() / 1));
+		if (!out.openedOk())
+			return false;
 
-			auto margin2 = r.removeFromTop(20);
+		return write(out, progression, settings) && out.getStatus().wasOk();
+	}
 
+private:
+	//ステップの境界のtick(エンジンがノートを置くステップの先頭と同じ位置)
+	static int64 getTick(int64 k, double stepLength)
+	{
+		return (int64)std::floor(k * stepLength * ticksPerQuarterNote + 0.5);
+	}
 
-			//コードの種類部分
-			auto rythmArea = r.removeFromTop(30);
-			Button_r1.setBounds(rythmArea.removeFromLeft(rythmArea.getWidth() / 4));
-			Button_r2.setBounds(rythmArea.removeFromLeft(rythmArea.getWidth() / 3));
-			Button_r3.setBounds(rythmArea.removeFromLeft(rythmArea.getWidth() / 2));
-			Button_r4.setBounds(rythmArea.removeFromLeft(rythmArea.getWidth() / 1));
+	static void releaseAll(StreamingMidiFileWriter& writer, bool sounding[128], int64 tick)
+	{
+		for (int note = 0; note < 128; note++) {
+			if (sounding[note]) {
+				writer.writeMessage(tick, MidiMessage::noteOff(1, note));
+				sounding[note] = false;
+			}
+		}
+	}
+};
 
 
-			auto margin3 = r.removeFromTop(65);
-			auto margin9 = r.removeFromBottom(18);
+//==============================================================================
+/** Standard MIDI Fileを読み込み、小節ごとのコードと奏法を推定してChordProgressionに書き込む。
+
+	ファイル全体をメモリに置いたまま(MemoryMappedFile)先頭から一度だけ走査し、
+	各小節の音名ごとの鳴っている長さと、16分音符単位の発音位置だけを固定長の配列に集める。
+	ノートごとのメモリ確保はないので、大きなマルチトラックのファイルもそのまま読める。
+	ドラム(チャンネル10)は無視する。ChordProgression::maxBarsより後ろの小節は読み捨て、
+	そうしたことをwasTruncatedで知らせる。 */
+class MidiFileImporter
+{
+public:
+	static bool read(const File& file, ChordProgression& progression, bool* wasTruncated = nullptr)
+	{
+		MemoryMappedFile mapped(file, MemoryMappedFile::readOnly);
 
-			//ジャンル部分
-			auto genreArea = r.removeFromLeft(r.getWidth() / 2);
-			auto marginC = genreArea.removeFromLeft(20);
-			auto marginD = genreArea.removeFromRight(60);
-			auto genrerow1 = genreArea.removeFromTop(genreArea.getHeight() / 2);
-			auto genrerow2 = genreArea.removeFromTop(genreArea.getHeight() / 1);
-			Button_g1.setBounds(genrerow1.removeFromLeft(genrerow1.getWidth() / 4));
-			Button_g2.setBounds(genrerow1.removeFromLeft(genrerow1.getWidth() / 3));
-			Button_g3.setBounds(genrerow1.removeFromLeft(genrerow1.getWidth() / 2));
-			Button_g4.setBounds(genrerow1.removeFromLeft(genrerow1.getWidth() / 1));
-			Button_g5.setBounds(genrerow2.removeFromLeft(genrerow2.getWidth() / 4));
-			Button_g6.setBounds(genrerow2.removeFromLeft(genrerow2.getWidth() / 3));
-			Button_g7.setBounds(genrerow2.removeFromLeft(genrerow2.getWidth() / 2));
-			Button_g8.setBounds(genrerow2.removeFromLeft(genrerow2.getWidth() / 1));
+		if (mapped.getData() != nullptr)
+			return read(mapped.getData(), mapped.getSize(), progression, wasTruncated);
 
+		MemoryBlock block;
+		return file.loadFileAsData(block) && read(block.getData(), block.getSize(), progression, wasTruncated);
+	}
 
-			//設定
-			auto stateArea = r.removeFromLeft(r.getWidth() / 1);
-			auto marginE = stateArea.removeFromLeft(80);
-			auto marginF = stateArea.removeFromRight(20);
-			auto staterow1 = stateArea.removeFromTop(stateArea.getHeight() / 2);
-			auto staterow2 = stateArea.removeFromTop(stateArea.getHeight());
+	static bool read(const void* data, size_t size, ChordProgression& progression, bool* wasTruncated = nullptr)
+	{
+		auto parser = std::make_unique<Parser>((const uint8*)data, size);
 
-			keyLabel.setBounds(staterow1.removeFromLeft(staterow1.getWidth()/2));
-			Button_keyL.setBounds(staterow1.removeFromLeft(staterow1.getWidth()/2));
-			Button_keyR.setBounds(staterow1.removeFromLeft(staterow1.getWidth()/1));
+		if (!parser->parse() || parser->numBarsUsed == 0)
+			return false;
 
-			toneLabel.setBounds(staterow2.removeFromLeft(staterow2.getWidth() / 2));
-			Button_toneL.setBounds(staterow2.removeFromLeft(staterow2.getWidth() / 2));
-			Button_toneR.setBounds(staterow2.removeFromLeft(staterow2.getWidth() / 1));
+		parser->apply(progression);
 
+		if (wasTruncated != nullptr)
+			*wasTruncated = parser->truncated;
 
-			//Button_key.setBounds(staterow1.removeFromLeft(staterow1.getWidth() / 1));
+		return true;
+	}
 
-			//Button_tone.setBounds(staterow2.removeFromLeft(staterow2.getWidth() / 1));
-			
-			
-			//timecodeDisplayLabel.setBounds(staterow1.removeFromLeft(staterow1.getWidth()));
-			//tempoDisplayLabel.setBounds(staterow2.removeFromLeft(staterow2.getWidth()));
+private:
+	static constexpr int maxTimeSignatures = 64;
+	static constexpr int drumChannel = 9;
 
-			auto sliderArea = r.removeFromTop(60);
+	struct Bar
+	{
+		double weight[12] = {}; //音名ごとの鳴っている長さ(小節の長さを1とする)
+		uint32 onsets = 0;      //16分音符単位の発音位置
+		int lowestNote = 128;
+	};
 
+	struct TimeSignature
+	{
+		int64 tick, firstBar, barLength, stepLength;
+	};
 
+	struct Parser
+	{
+		Parser(const uint8* d, size_t size) : data(d), end(d + size) {}
 
-			lastUIWidth = getWidth();
-			lastUIHeight = getHeight();
+		const uint8* data;
+		const uint8* end;
+		int ppq = 0;
 
-		}
+		TimeSignature signatures[maxTimeSignatures];
+		int numSignatures = 0;
 
-		void timerCallback() override
-		{
-			updateTimecodeDisplay(getProcessor().lastPosInfo);
-		}
+		Bar bars[ChordProgression::maxBars];
+		int numBarsUsed = 0;
+		bool truncated = false; //maxBarsより後ろにノートがあった
 
-		void hostMIDIControllerIsAvailable(bool controllerIsAvailable) override
-		{
-			midiKeyboard.setVisible(!controllerIsAvailable);
-		}
+		int64 noteStart[16][128]; //鳴っているノートの開始tick(-1は鳴っていない)
+		uint8 lastChannelStatus = 0; //リアルタイムメッセージの後で戻すランニングステータス
 
-		int getControlParameterIndex(Component& control) override
+		bool parse()
 		{
-			if (&control == &gainSlider)
-				return 0;
+			auto p = data;
 
-			if (&control == &delaySlider)
-				return 1;
+			if (end - p >= 8 && std::memcmp(p, "RIFF", 4) == 0) //RMID
+				p += 20;
 
-			return -1;
+			if (end - p < 14 || std::memcmp(p, "MThd", 4) != 0)
+				return false;
+
+			auto headerLength = readInt(p + 4);
+			ppq = (p[12] << 8) | p[13];
+
+			if (headerLength < 6 || headerLength > end - p - 8)
+				return false;
+
+			if (ppq == 0 || (ppq & 0x8000) != 0) //SMPTEの時間単位は小節に変換できない
+				return false;
+
+			p += 8 + headerLength;
+			addTimeSignature(0, 4, 4);
+
+			while (end - p >= 8) {
+				auto chunkLength = (size_t)readInt(p + 4);
+				auto chunk = p + 8;
+				auto chunkEnd = chunk + jmin(chunkLength, (size_t)(end - chunk));
+
+				if (std::memcmp(p, "MTrk", 4) == 0)
+					parseTrack(chunk, chunkEnd);
+
+				p = chunkEnd;
+			}
+
+			return true;
 		}
 
-		//ボタンをクリックしたときの処理
-		void buttonClicked(Button* clickedButton) override
+		void parseTrack(const uint8* p, const uint8* trackEnd)
 		{
-			int number;
+			for (auto& channel : noteStart)
+				for (auto& start : channel)
+					start = -1;
 
-			number = 0;
-			if (clickedButton == &Button_g1) {
-				g_push[number] = updateChordValue(number, g_push[number]);
-			}
+			int64 tick = 0;
+			uint8 status = 0;
+			lastChannelStatus = 0;
 
-			number++;
-			if (clickedButton == &Button_g2) {
-				g_push[number] = updateChordValue(number, g_push[number]);
-			}
+			while (p < trackEnd) {
+				tick += readVariableLength(p, trackEnd);
 
-			number++;
-			if (clickedButton == &Button_g3) {
-				g_push[number] = updateChordValue(number, g_push[number]);
-			}
+				if (p >= trackEnd)
+					break;
 
-			number++;
-			if (clickedButton == &Button_g4) {
-				g_push[number] = updateChordValue(number, g_push[number]);
-			}
+				if (*p & 0x80) {
+					status = *p++;
+				}
+				else if (status == 0) {
+					//ランニングステータスがないのにデータバイトが来たら、次のステータスバイトまで読み飛ばす
+					while (p < trackEnd && (*p & 0x80) == 0)
+						++p;
 
-			number++;
-			if (clickedButton == &Button_g5) {
-				g_push[number] = updateChordValue(number, g_push[number]);
-			}
+					if (p >= trackEnd)
+						break;
 
-			number++;
-			if (clickedButton == &Button_g6) {
-				g_push[number] = updateChordValue(number, g_push[number]);
-			}
+					status = *p++;
+				}
 
-			number++;
-			if (clickedButton == &Button_g7) {
-				g_push[number] = updateChordValue(number, g_push[number]);
-			}
+				if (status == 0xff) {
+					if (p >= trackEnd)
+						break;
 
-			number++;
-			if (clickedButton == &Button_g8) {
-				g_push[number] = updateChordValue(number, g_push[number]);
-			}
+					auto type = *p++;
+					auto length = readVariableLength(p, trackEnd);
+
+					if (type == 0x58 && length >= 2 && trackEnd - p >= 2)
+						addTimeSignature(tick, p[0], 1 << jmin((int)p[1], 6));
+
+					p += jmin(length, (int64)(trackEnd - p));
+					status = 0;
+				}
+				else if (status == 0xf0 || status == 0xf7) {
+					auto length = readVariableLength(p, trackEnd);
+					p += jmin(length, (int64)(trackEnd - p));
+					status = 0;
+				}
+				else if (status >= 0xf8) {
+					//リアルタイムメッセージはデータバイトを持たず、ランニングステータスも変えない
+					status = lastChannelStatus;
+				}
+				else if (status > 0xf0) {
+					//システムコモン: F1(MTCクォーターフレーム)とF3(ソングセレクト)は1バイト、F2(ソングポジション)は2バイト、
+					//F4 F5 F6は0バイト。ランニングステータスは取り消す
+					auto numDataBytes = status == 0xf2 ? 2 : ((status == 0xf1 || status == 0xf3) ? 1 : 0);
+					p += jmin((int64)numDataBytes, (int64)(trackEnd - p));
+					status = 0;
+				}
+				else {
+					auto type = status & 0xf0;
+					auto numDataBytes = (type == 0xc0 || type == 0xd0) ? 1 : 2;
 
-			number = Page;
-			if (clickedButton == &Button_r1) {
-				updatePattern(number, Pattern_Value[number]);
-			}
+					if (trackEnd - p < numDataBytes)
+						break;
 
-			number++;
-			if (clickedButton == &Button_r2) {
-				updatePattern(number, Pattern_Value[number]);
-			}
+					auto channel = status & 0x0f;
+					auto note = p[0] & 0x7f;
+					auto velocity = numDataBytes > 1 ? p[1] : 0;
+					p += numDataBytes;
+					lastChannelStatus = status;
 
-			number++;
-			if (clickedButton == &Button_r3) {
-				updatePattern(number, Pattern_Value[number]);
-			}
+					if (channel == drumChannel || (type != 0x80 && type != 0x90))
+						continue;
 
-			number++;
-			if (clickedButton == &Button_r4) {
-				updatePattern(number, Pattern_Value[number]);
-			}
+					endNote(channel, note, tick);
 
-			if (clickedButton == &Button_L && Page != 0) {
-				Page = 0;
-				updateChordLabel();
-				updatePatternLabel();
+					if (type == 0x90 && velocity > 0)
+						startNote(channel, note, tick);
+				}
 			}
 
-			if (clickedButton == &Button_R && Page == 0) {
-				Page = 4;
-				updateChordLabel();
-				updatePatternLabel();
-			}
+			for (int channel = 0; channel < 16; channel++)
+				for (int note = 0; note < 128; note++)
+					endNote(channel, note, tick);
+		}
 
-			if (clickedButton == &Button_keyL && Pitch != -12) {
-				Pitch--;
-				updatePitchLavel();
-			}
+		void startNote(int channel, int note, int64 tick)
+		{
+			noteStart[channel][note] = tick;
 
-			if (clickedButton == &Button_keyR && Pitch != 12) {
-				Pitch++;
-				updatePitchLavel();
-				
-			}
+			//発音位置は16分音符のグリッドに丸めてから小節とステップを求める
+			auto& sig = getSignature(tick);
+			auto quantised = sig.tick + ((tick - sig.tick + sig.stepLength / 2) / sig.stepLength) * sig.stepLength;
+			auto bar = getBarIndex(quantised);
 
-			if (clickedButton == &Button_toneL && Tone != 0) {
-				Tone--;
-				updateToneLavel();
+			if (!isPositiveAndBelow(bar, (int64)ChordProgression::maxBars)) {
+				truncated = truncated || bar >= ChordProgression::maxBars;
+				return;
 			}
 
-			if (clickedButton == &Button_toneR && Tone != 4) {
-				Tone++;
-				updateToneLavel();
-			}
+			auto& barSig = getSignatureForBar(bar);
+			auto step = (int)(((quantised - getBarStart(barSig, bar)) / barSig.stepLength) % 16);
 
+			bars[bar].onsets |= (uint32)1 << step;
+			bars[bar].lowestNote = jmin(bars[bar].lowestNote, note);
+			numBarsUsed = jmax(numBarsUsed, (int)bar + 1);
+		}
 
+		void endNote(int channel, int note, int64 tick)
+		{
+			auto start = noteStart[channel][note];
 
-		}
+			if (start < 0)
+				return;
 
-		//キーの変更処理
-		void updatePitchLavel() {
-			MemoryOutputStream Text;
+			noteStart[channel][note] = -1;
 
-			Text <<  "Key:" << Chord_Name[(Pitch+12)%12] << String::formatted("(%d)", Pitch);
-			keyLabel.setText(Text.toString(), dontSendNotification);
-			updateChordLabel();
+			//小節をまたぐノートは、それぞれの小節に重なっている分だけ数える
+			for (auto bar = getBarIndex(start); bar < ChordProgression::maxBars; ++bar) {
+				auto& sig = getSignatureForBar(bar);
+				auto barStart = getBarStart(sig, bar);
+				auto barEnd = barStart + sig.barLength;
 
-		}
-		//音色の変更処理(未実装)
-		void updateToneLavel() {
-			MemoryOutputStream Text;
-			String inst[5] = { "Piano","Guitor","Synth","Strings","Bit" };
-			Text << "Tone:" <<  inst[Tone]; //String::formatted("Key:%d", Pitch);
-			toneLabel.setText(Text.toString(), dontSendNotification);
+				if (barStart >= tick)
+					break;
 
+				auto overlap = jmin(tick, barEnd) - jmax(start, barStart);
 
+				if (overlap > 0) {
+					bars[bar].weight[note % 12] += overlap / (double)sig.barLength;
+					numBarsUsed = jmax(numBarsUsed, (int)bar + 1);
+				}
+			}
 		}
 
-
-		void updateTrackProperties()
+		//拍子記号は出てきた順に記録する(フォーマット1では最初のトラックにまとまっている)
+		void addTimeSignature(int64 tick, int numerator, int denominator)
 		{
-			auto trackColour = getProcessor().getTrackProperties().colour;
-			auto& lf = getLookAndFeel();
+			if (numerator <= 0)
+				return;
 
-			backgroundColour = (trackColour == Colour() ? lf.findColour(ResizableWindow::backgroundColourId)
-				: trackColour.withAlpha(1.0f).withBrightness(0.266f));
-			repaint();
-		}
+			TimeSignature sig;
+			sig.tick = tick;
+			sig.firstBar = 0;
+			sig.barLength = jmax((int64)1, (int64)ppq * 4 * numerator / denominator);
+			sig.stepLength = jmax((int64)1, sig.barLength / ChordStepEngine::getStepsPerBar(numerator));
 
-		//コードの値の更新
-		int updateChordValue(int n, int push) {
-			if (push == 0) {
-				push++;
-				n = 2 * n;
-			}
-			else {
-				push--;
-				n = 2 * n + 1;
+			if (numSignatures > 0) {
+				auto& last = signatures[numSignatures - 1];
 
-			}
+				if (tick < last.tick)
+					return;
 
-			for (int i = 0; i < 8; i++) {
-				for (int j = 0; j < 2; j++) {
-					Chord_Value[i][j] = Chord_g1[n][i][j];
+				if (tick == last.tick) {
+					sig.firstBar = last.firstBar;
+					last = sig;
+					return;
 				}
 
-			}
-
-			updateChordLabel();
+				if (numSignatures == maxTimeSignatures)
+					return;
 
+				sig.firstBar = last.firstBar + (tick - last.tick + last.barLength - 1) / last.barLength;
+				sig.tick = getBarStart(last, sig.firstBar);
+			}
 
-			return push;
+			signatures[numSignatures++] = sig;
 		}
 
-		//コードの値の更新
-		void updatePattern(int n, int push) {
-
-
+		const TimeSignature& getSignature(int64 tick) const
+		{
+			auto i = numSignatures - 1;
 
-			Pattern_Value[n] = (push + 1) % 5;
+			while (i > 0 && signatures[i].tick > tick)
+				--i;
 
-			updatePatternLabel();
+			return signatures[i];
+		}
 
+		int64 getBarIndex(int64 tick) const
+		{
+			auto& sig = getSignature(tick);
+			return sig.firstBar + (tick - sig.tick) / sig.barLength;
+		}
 
+		static int64 getBarStart(const TimeSignature& sig, int64 bar)
+		{
+			return sig.tick + (bar - sig.firstBar) * sig.barLength;
 		}
 
+		const TimeSignature& getSignatureForBar(int64 bar) const
+		{
+			auto i = numSignatures - 1;
 
-		float mod(float a, float b){
-			return a - std::floor(a / b) * b;
+			while (i > 0 && signatures[i].firstBar > bar)
+				--i;
+
+			return signatures[i];
 		}
 
-		//コードのボタン上のラベルを更新
-		void updateChordLabel() {
+		void apply(ChordProgression& progression) const
+		{
+			uint32 patternOnsets[ChordProgression::numPatterns];
 
-			int v[4] = { Chord_Value[0 + Page][0],Chord_Value[1 + Page][0],Chord_Value[2 + Page][0],Chord_Value[3 + Page][0] };
-			for (int i = 0; i < 4; i++) {
-				v[i] = (v[i] + Pitch)>=0 ? (v[i] + Pitch) % 12 : ((v[i] + Pitch + 12) % 12) ;
-			}
-		
-			Button_c1.setButtonText(Chord_Name[v[0]] + Chord_Type[Chord_Value[0 + Page][1]]);
-			Button_c2.setButtonText(Chord_Name[v[1]] + Chord_Type[Chord_Value[1 + Page][1]]);
-			Button_c3.setButtonText(Chord_Name[v[2]] + Chord_Type[Chord_Value[2 + Page][1]]);
-			Button_c4.setButtonText(Chord_Name[v[3]] + Chord_Type[Chord_Value[3 + Page][1]]);
+			for (int i = 0; i < ChordProgression::numPatterns; i++)
+				patternOnsets[i] = getPatternOnsets(i);
 
+			auto numBars = jmin(numBarsUsed, ChordProgression::maxBars);
+			progression.setNumBars(numBars);
 
-		}
-		void updatePatternLabel() {
+			for (int bar = 0; bar < numBars; bar++) {
+				int root = 0, type = 0;
 
-			Button_r1.setButtonText(Pattern_Name[Pattern_Value[0 + Page]]);
+				//音のない小節は前の小節をそのまま続ける
+				if (!detectChord(bars[bar], root, type)) {
+					if (bar > 0) {
+						progression.setChord(bar, progression.getRoot(bar - 1), progression.getType(bar - 1));
+						progression.setPattern(bar, progression.getPattern(bar - 1));
+					}
+					continue;
+				}
 
-			Button_r2.setButtonText(Pattern_Name[Pattern_Value[1 + Page]]);
+				//キーの設定はそのままにして、鳴る音名がファイルと同じになるようにする
+				progression.setChord(bar, ((root - progression.getPitch()) % 12 + 12) % 12, type);
 
-			Button_r3.setButtonText(Pattern_Name[Pattern_Value[2 + Page]]);
+				auto bestPattern = 0, bestDistance = 17;
 
-			Button_r4.setButtonText(Pattern_Name[Pattern_Value[3 + Page]]);
+				for (int i = 0; i < ChordProgression::numPatterns; i++) {
+					auto distance = countNumberOfBits(bars[bar].onsets ^ patternOnsets[i]);
 
+					if (distance < bestDistance) {
+						bestDistance = distance;
+						bestPattern = i;
+					}
+				}
 
+				progression.setPattern(bar, bestPattern);
+			}
 		}
 
+		//音名ごとの長さから、含まれる音が最も多く余計な音が最も少ないコードを選ぶ。
+		//同点なら単純なコード(種類の番号が小さい方)、最低音と根音が一致するものを優先する
+		static bool detectChord(const Bar& bar, int& root, int& type)
+		{
+			double total = 0;
 
+			for (auto w : bar.weight)
+				total += w;
 
+			if (total <= 0)
+				return false;
 
-	private:
-
-		Label timecodeDisplayLabel, tempoDisplayLabel;
+			auto bestScore = -1.0e9;
 
-		//使用コンポーネントの宣言
-		MidiKeyboardComponent midiKeyboard;
-		Label TempoLabel;
-		Slider gainSlider, delaySlider;
-		TextButton Button_c1;
-		TextButton Button_c2;
-		TextButton Button_c3;
-		TextButton Button_c4;
-		TextButton Button_r1;
-		TextButton Button_r2;
-		TextButton Button_r3;
-		TextButton Button_r4;
-		TextButton Button_g1;
-		TextButton Button_g2;
-		TextButton Button_g3;
-		TextButton Button_g4;
-		TextButton Button_g5;
-		TextButton Button_g6;
-		TextButton Button_g7;
-		TextButton Button_g8;
-		TextButton Button_L;
-		TextButton Button_R;
-		TextButton Button_keyL;
-		TextButton Button_keyR;
-		TextButton Button_toneL;
-		TextButton Button_toneR;
-		Label keyLabel;
-		Label toneLabel;
+			for (int t = 0; t < ChordProgression::numChordTypes; t++) {
+				int key[5] = { 0,4,7,-1,-1 };
+				ChordStepEngine::ChordKeyCheck(key, t);
 
+				for (int r = 0; r < 12; r++) {
+					bool isChordTone[12] = {};
+					int numMissing = 0;
 
-		
+					for (int i = 0; i < 4 && key[i] != -1; i++) {
+						isChordTone[(r + key[i]) % 12] = true;
 
+						if (bar.weight[(r + key[i]) % 12] <= 0)
+							numMissing++;
+					}
 
-		
+					double score = 0;
 
+					for (int pc = 0; pc < 12; pc++)
+						score += (isChordTone[pc] ? bar.weight[pc] : -bar.weight[pc]) / total;
 
-		Image image_background;
+					score -= 0.15 * numMissing;
 
-		int midiChannel = 10;
-		double startTime;
+					if (bar.lowestNote < 128 && bar.lowestNote % 12 == r)
+						score += 0.1;
 
-		AudioProcessorValueTreeState::SliderAttachment gainAttachment, delayAttachment;
-		Colour backgroundColour;
+					if (score > bestScore + 1.0e-9) {
+						bestScore = score;
+						root = r;
+						type = t;
+					}
+				}
+			}
 
-		// these are used to persist the UI's size - the values are stored along with the
-		// filter's other parameters, and the UI component will update them when it gets
-		// resized.
-		Value lastUIWidth, lastUIHeight;
+			return true;
+		}
 
-		//==============================================================================
-		JuceDemoPluginAudioProcessor& getProcessor() const
+		//奏法ごとの発音位置はChordStepEngineから求める
+		static uint32 getPatternOnsets(int pattern)
 		{
-			return static_cast<JuceDemoPluginAudioProcessor&> (processor);
+			ChordProgression progression;
+			progression.setPattern(0, pattern);
+
+			uint32 onsets = 0;
+
+			for (int step = 0; step < 16; step++)
+				if (ChordStepEngine::getStep(progression, 0, step, step == 0, true).numNotes > 0)
+					onsets |= (uint32)1 << step;
+
+			return onsets;
 		}
 
-		//==============================================================================
-		// quick-and-dirty function to format a timecode string
-		static String timeToTimecodeString(double seconds)
+		static int readInt(const uint8* p)
 		{
-			auto millisecs = roundToInt(seconds * 1000.0);
-			auto absMillisecs = std::abs(millisecs);
-
-			return String::formatted("%02d:%02d:%02d.%03d",
-				millisecs / 3600000,
-				(absMillisecs / 60000) % 60,
-				(absMillisecs / 1000) % 60,
-				absMillisecs % 1000);
+			return (int)(((uint32)p[0] << 24) | ((uint32)p[1] << 16) | ((uint32)p[2] << 8) | p[3]);
 		}
 
-		// quick-and-dirty function to format a bars/beats string
-		static String quarterNotePositionToBarsBeatsString(double quarterNotes, int numerator, int denominator)
+		static int64 readVariableLength(const uint8*& p, const uint8* limit)
 		{
-			if (numerator == 0 || denominator == 0)
-				return "1|1|000";
+			int64 value = 0;
 
-			auto quarterNotesPerBar = (numerator * 4 / denominator);
-			auto beats = (fmod(quarterNotes, quarterNotesPerBar) / quarterNotesPerBar) * numerator;
+			for (int i = 0; i < 4 && p < limit; i++) {
+				auto b = *p++;
+				value = (value << 7) | (b & 0x7f);
 
-			auto bar = ((((int)quarterNotes) / quarterNotesPerBar)% 8) + 1;
-			auto beat = ((int)beats) + 1;
-			auto ticks = ((int)(fmod(beats, 1.0) * 960.0 + 0.5));
+				if ((b & 0x80) == 0)
+					break;
+			}
 
-			return String::formatted("%d|%d|%03d", bar, beat, ticks);
+			return value;
 		}
+	};
+};
 
-		// Updates the text in our position label.
-		void updateTimecodeDisplay(AudioPlayHead::CurrentPositionInfo pos)
-		{
-			MemoryOutputStream displayText;
-			MemoryOutputStream displayText2; //ƒeƒ“ƒ|
 
-			displayText << pos.timeSigNumerator << '/' << pos.timeSigDenominator
-				<< "  -  " << timeToTimecodeString(pos.timeInSeconds)
-				<< "  -  " << quarterNotePositionToBarsBeatsString(pos.ppqPosition,
-					pos.timeSigNumerator,
-					pos.timeSigDenominator);
-			displayText2 << " Tempo: " << String(pos.bpm, 2);
+//==============================================================================
+//進行、サンプル、設定はメッセージスレッドで写し取り、レンダリングと書き込みだけをこのスレッドで行う
+class JuceDemoPluginAudioProcessor::AudioExportThread : public Thread
+{
+public:
+	AudioExportThread(JuceDemoPluginAudioProcessor& processor, const File& fileToWrite)
+		: Thread("Chord Progressor audio export"),
+		owner(&processor),
+		renderer(processor.progression, processor.getSample(), getSettings(processor)),
+		file(fileToWrite)
+	{
+	}
 
-			if (pos.isRecording)
-				displayText << "  (record)";
-			else if (pos.isPlaying)
-				displayText << "  (play)";
+	//ホストのテンポ、拍子、サンプルレートとパラメータから書き出しの設定を作る(メッセージスレッドから呼ぶ)
+	static OfflineRenderer::Settings getSettings(JuceDemoPluginAudioProcessor& processor)
+	{
+		OfflineRenderer::Settings settings;
+		processor.pollAudioStatus();
+		auto pos = processor.getAudioStatus().position;
 
-			timecodeDisplayLabel.setText(displayText.toString(), dontSendNotification);
-			tempoDisplayLabel.setText(displayText2.toString(), dontSendNotification);
-		}
+		if (pos.bpm > 0)
+			settings.bpm = pos.bpm;
 
-		// called when the stored window size changes
-		void valueChanged(Value&) override
-		{
-			setSize(800, 600);
+		if (pos.timeSigNumerator > 0 && pos.timeSigDenominator > 0) {
+			settings.timeSigNumerator = pos.timeSigNumerator;
+			settings.timeSigDenominator = pos.timeSigDenominator;
 		}
-	};
 
-	//==============================================================================
+		if (processor.getSampleRate() > 0)
+			settings.sampleRate = processor.getSampleRate();
 
+		settings.gain = processor.state.getRawParameterValue("gain")->load();
+		settings.delay = processor.state.getRawParameterValue("delay")->load();
+		return settings;
+	}
 
-	template <typename FloatType>
-	void applyGain(AudioBuffer<FloatType>& buffer, AudioBuffer<FloatType>& delayBuffer, float gainLevel)
+	void run() override
 	{
-		ignoreUnused(delayBuffer);
+		auto succeeded = renderer.renderToFile(file);
 
-		for (auto channel = 0; channel < getTotalNumOutputChannels(); ++channel)
-			buffer.applyGain(channel, 0, buffer.getNumSamples(), gainLevel);
+		//プロセッサが先に消えていたら何もしない
+		auto safeOwner = owner;
+		auto writtenFile = file;
+
+		MessageManager::callAsync([safeOwner, writtenFile, succeeded]
+			{
+				if (auto* processor = safeOwner.get())
+					processor->audioExportFinished(writtenFile, succeeded);
+			});
 	}
 
-	template <typename FloatType>
-	void applyDelay(AudioBuffer<FloatType>& buffer, AudioBuffer<FloatType>& delayBuffer, float delayLevel)
-	{
-		auto numSamples = buffer.getNumSamples();
+private:
+	WeakReference<JuceDemoPluginAudioProcessor> owner;
+	OfflineRenderer renderer;
+	File file;
 
-		auto delayPos = 0;
+	JUCE_DECLARE_NON_COPYABLE(AudioExportThread)
+};
 
-		for (auto channel = 0; channel < getTotalNumOutputChannels(); ++channel)
-		{
-			auto channelData = buffer.getWritePointer(channel);
-			auto delayData = delayBuffer.getWritePointer(jmin(channel, delayBuffer.getNumChannels() - 1));
-			delayPos = delayPosition;
+inline bool JuceDemoPluginAudioProcessor::exportAudio(const File& file)
+{
+	return OfflineRenderer(progression, getSample(), AudioExportThread::getSettings(*this)).renderToFile(file);
+}
 
-			for (auto i = 0; i < numSamples; ++i)
-			{
-				auto in = channelData[i];
-				channelData[i] += delayData[delayPos];
-				delayData[delayPos] = (delayData[delayPos] + in) * delayLevel;
+inline void JuceDemoPluginAudioProcessor::exportAudio()
+{
+	if (isExportingAudio())
+		return;
 
-				if (++delayPos >= delayBuffer.getNumSamples())
-					delayPos = 0;
-			}
-		}
+	FileChooser chooser("Export the progression as audio.", File::getSpecialLocation(File::userMusicDirectory), "*.wav;*.flac");
 
-		delayPosition = delayPos;
+	if (chooser.browseForFileToSave(true)) {
+		auto file = chooser.getResult();
+
+		if (!file.hasFileExtension("wav;flac"))
+			file = file.withFileExtension("wav");
+
+		audioExportThread.reset(new AudioExportThread(*this, file));
+		audioExportThread->startThread();
 	}
+}
 
-	AudioBuffer<float> delayBufferFloat;
-	AudioBuffer<double> delayBufferDouble;
+inline void JuceDemoPluginAudioProcessor::audioExportFinished(const File& file, bool succeeded)
+{
+	if (audioExportThread != nullptr) {
+		audioExportThread->stopThread(-1);
+		audioExportThread.reset();
+	}
 
-	int delayPosition = 0;
+	if (succeeded)
+		AlertWindow::showMessageBoxAsync(AlertWindow::InfoIcon, "Export finished", "Wrote " + file.getFullPathName());
+	else
+		AlertWindow::showMessageBoxAsync(AlertWindow::WarningIcon, "Export failed", "Could not write " + file.getFullPathName());
+}
 
-	Synthesiser synth;
+inline bool JuceDemoPluginAudioProcessor::exportMidi(const File& file)
+{
+	MidiFileExporter::Settings settings;
+	pollAudioStatus();
+	auto pos = getAudioStatus().position;
 
-	CriticalSection trackPropertiesLock;
-	TrackProperties trackProperties;
+	if (pos.bpm > 0)
+		settings.bpm = pos.bpm;
 
+	if (pos.timeSigNumerator > 0 && pos.timeSigDenominator > 0) {
+		settings.timeSigNumerator = pos.timeSigNumerator;
+		settings.timeSigDenominator = pos.timeSigDenominator;
+	}
 
+	return MidiFileExporter::write(file, progression, settings);
+}
 
-	void updateCurrentTimeInfoFromHost(int a[])
-	{
-		if (auto* ph = getPlayHead())
-		{
-			AudioPlayHead::CurrentPositionInfo newTime;
+//エディタからホストへドラッグするための一時ファイル
+inline File JuceDemoPluginAudioProcessor::exportMidiToTempFile()
+{
+	//インスタンスごとに別の名前を1つ決めておき、2回目からは同じファイルに書き直す
+	if (midiDragFile == File())
+		midiDragFile = File::getSpecialLocation(File::tempDirectory).getNonexistentChildFile("Chord Progressor", ".mid", false);
 
-			if (ph->getCurrentPosition(newTime))
-			{
-				lastPosInfo = newTime;  // Successfully got the current time from the host..
+	if (!exportMidi(midiDragFile))
+		return {};
 
+	return midiDragFile;
+}
 
+inline bool JuceDemoPluginAudioProcessor::importMidi(const File& file)
+{
+	auto truncated = false;
 
-				/*
-				pos.ppqPosition,
-					pos.timeSigNumerator,
-					pos.timeSigDenominator*/
+	if (!MidiFileImporter::read(file, progression, &truncated))
+		return false;
 
-				auto quarterNotesPerBar = (newTime.timeSigNumerator * 4 / newTime.timeSigDenominator);
-				auto beats = (fmod(newTime.ppqPosition, quarterNotesPerBar) / quarterNotesPerBar) * newTime.timeSigNumerator;
-				
-				beats *= 4;
+	commitProgression();
 
-				int bar = (((((int)newTime.ppqPosition) / quarterNotesPerBar)) % 8); //0から7
-				int beat = ((((int)beats)) % 16); //0から16
+	if (truncated)
+		AlertWindow::showMessageBoxAsync(AlertWindow::WarningIcon, "MIDI import",
+			file.getFileName() + " is longer than " + String(ChordProgression::maxBars) + " bars. Only the first "
+			+ String(ChordProgression::maxBars) + " bars were imported.");
 
-				a[1] = a[0];
-				a[0] = bar;
-				a[3] = a[2];
-				a[2] = beat;
+	return true;
+}
 
+inline void JuceDemoPluginAudioProcessor::setRenderCacheEnabled(bool shouldBeEnabled, size_t memoryBudgetBytes)
+{
+	std::unique_ptr<BarRenderCache> newCache;
 
-				return;
-			}
+	if (shouldBeEnabled) {
+		if (renderCache != nullptr) {
+			renderCache->setMemoryBudget(memoryBudgetBytes);
+			return;
 		}
 
-		// If the host fails to provide the current time, we'll just reset our copy to a default..
-		lastPosInfo.resetToDefault();
+		//ゲイン1、ディレイなしの素の音をレンダリングし、出力段は再生時にかける
+		OfflineRenderer::Settings settings;
+		settings.gain = 1.0f;
+		settings.delay = 0.0f;
+
+		std::shared_ptr<JuceDemoPluginAudioProcessor> engine(OfflineRenderer::createEngine(progression, getSample(), settings));
+
+		newCache = std::make_unique<BarRenderCache>([engine](const BarRenderCache::Key& key, SharedSample::Ptr sample, BarRenderCache::Entry& entry)
+			{
+				ChordProgression context;
+				context.setNumBars(1 + key.numTailBars);
+				context.setPitch(key.pitch);
+				context.setTone(key.tone);
+
+				for (int i = 0; i <= key.numTailBars; i++) {
+					context.setChord(i, key.bars[i][0], key.bars[i][1]);
+					context.setPattern(i, key.bars[i][2]);
+				}
+
+				OfflineRenderer::Settings s;
+				s.sampleRate = key.sampleRate;
+				s.bpm = key.bpm;
+				s.timeSigNumerator = key.timeSigNumerator;
+				s.timeSigDenominator = key.timeSigDenominator;
+
+				//残響は続く小節の終わりまでで止める(その先の小節で鳴り直す音は鍵に入っていない)
+				auto tailEnd = OfflineRenderer::getBarStartSample(1 + key.numTailBars, s);
+				auto barEnd = OfflineRenderer::getBarStartSample(1, s);
+				s.maxTailSeconds = jmin(BarRenderCache::tailSeconds, (double)(tailEnd - barEnd) / s.sampleRate);
+
+				engine->setRenderProgression(context);
+
+				if (engine->getSample() != sample)
+					engine->setupSampler(sample);
+
+				engine->setRateAndBufferSizeDetails(s.sampleRate, s.blockSize);
+
+				//続く小節のノートで切れる音まで含めて、この小節だけを残響が消えるまで描く
+				OfflineRenderer::renderSection(*engine, s, 0, 1, 1 + key.numTailBars, entry.audio, entry.length);
+				entry.audio.setSize(entry.audio.getNumChannels(), entry.length, true, false, false);
+				entry.barLength = (int)barEnd;
+
+				//上限で打ち切ったときは、末尾を短くフェードアウトしてプチノイズを避ける
+				if (entry.length >= (int)(barEnd + (int64)(s.maxTailSeconds * s.sampleRate))) {
+					auto fadeLength = jmin(entry.length - entry.barLength, roundToInt(s.sampleRate * 0.005));
+					entry.audio.applyGainRamp(entry.length - fadeLength, fadeLength, 1.0f, 0.0f);
+				}
+			}, memoryBudgetBytes);
+
+		newCache->setSample(getSample());
 	}
 
-	static BusesProperties getBusesProperties()
 	{
-		return BusesProperties().withInput("Input", AudioChannelSet::stereo(), false)
-			.withOutput("Output", AudioChannelSet::stereo(), true);
+		const ScopedLock sl(getCallbackLock());
+		std::swap(renderCache, newCache);
+		stopCachedBars();
 	}
 
-	JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(JuceDemoPluginAudioProcessor);
-};
+	//無効にしたキャッシュはここ(ロックの外)で止める
+}
+
+
+//==============================================================================
+inline int RealtimeSafetyChecker::runHeadlessCheck(int numBlocks, int blockSize, double sampleRate)
+{
+   #if ! CHORDP_RT_SAFETY_HOOKS
+	ignoreUnused(numBlocks, blockSize, sampleRate);
+	Logger::writeToLog("Real-time safety check: needs a standalone-only build with CHORDP_RT_SAFETY_CHECKS=1");
+	return -1;
+   #else
+	OfflineRenderer::Settings settings;
+	settings.sampleRate = sampleRate;
+	settings.blockSize = blockSize;
+
+	ChordProgression progression;
+	progression.loadGenrePreset(0);
+
+	for (int bar = 0; bar < progression.getNumBars(); ++bar)
+		progression.setPattern(bar, bar % ChordProgression::numPatterns);
+
+	//ホストのトランスポートがないので内部のトランスポートで鳴らす。合成は実時間の設定にする
+	auto engine = OfflineRenderer::createEngine(progression, nullptr, settings);
+	engine->setNonRealtime(false);
+	engine->setAuditionEnabled(true);
+	engine->prepareToPlay(sampleRate, blockSize);
+
+	//ホストと同じく、MIDIバッファは前もって確保したものを渡す
+	AudioBuffer<float> buffer(2, blockSize);
+	MidiBuffer midi; //ホストと同じく既定の大きさのまま使い回す
+
+	resetViolations();
+
+	//キャッシュなしとキャッシュありの両方の経路を通す
+	for (int pass = 0; pass < 2; ++pass) {
+		engine->setRenderCacheEnabled(pass == 1);
+
+		for (int block = 0; block < numBlocks; ++block) {
+			//メッセージスレッド側の操作(画面の鍵盤、進行の編集)もブロックの合間に混ぜる
+			if (block % 50 == 0)
+				engine->getMidiKeyboardState().noteOn(1, 60 + (block / 50) % 12, 0.8f);
+			else if (block % 50 == 25)
+				engine->getMidiKeyboardState().allNotesOff(1);
+
+			if (block % 400 == 200) {
+				progression.setPattern((block / 400) % progression.getNumBars(), (block / 400) % ChordProgression::numPatterns);
+				engine->setProgression(progression);
+			}
+
+			midi.clear();
+			buffer.clear();
+			engine->processBlock(buffer, midi);
+		}
+	}
+
+	engine->setRenderCacheEnabled(false);
+
+	auto numViolations = getNumViolations();
+
+	if (numViolations == 0)
+		Logger::writeToLog(String::formatted("Real-time safety check: %d blocks passed", numBlocks * 2));
+	else
+		Logger::writeToLog(String::formatted("Real-time safety check: %d violations, first: ", numViolations) + getFirstViolation());
+
+	return numViolations;
+   #endif
+}
@@ -9,6 +9,48 @@
 #include <JuceHeader.h>
 #include "Chordp.h"
 
+//==============================================================================
+// スタンドアロンをコマンドラインから起動したときだけ使う、画面を使わない機能
+//   --batch-render <directory>  ジャンルのプリセット × 奏法 × キーのすべての組み合わせをWAVで書き出す
+//   --rt-check                  内蔵エンジンを実時間の設定で鳴らし、実時間処理の違反を調べる
+//                               (CHORDP_RT_SAFETY_CHECKS=1 でスタンドアロンだけを作るビルドが必要)
+// 実行したら終了コード(失敗や違反があれば1)を設定してアプリケーションを終える
+static bool runCommandLineTool(JuceDemoPluginAudioProcessor& processor)
+{
+    auto* app = JUCEApplicationBase::getInstance();
+
+    if (app == nullptr || PluginHostType::getPluginLoadedAs() != AudioProcessor::wrapperType_Standalone)
+        return false;
+
+    auto args = JUCEApplicationBase::getCommandLineParameterArray();
+    auto batchIndex = args.indexOf("--batch-render");
+    auto exitCode = 1;
+
+    if (args.contains("--rt-check")) {
+        if (RealtimeSafetyChecker::runHeadlessCheck() == 0)
+            exitCode = 0;
+    }
+    else if (batchIndex >= 0) {
+        if (batchIndex + 1 < args.size()) {
+            auto directory = File::getCurrentWorkingDirectory().getChildFile(args[batchIndex + 1].unquoted());
+            auto result = ProgressionBatchRenderer(processor.getSample(), {}).renderAll(directory);
+
+            if (result.numRenders > 0 && result.numFailed == 0)
+                exitCode = 0;
+        }
+        else {
+            Logger::writeToLog("usage: --batch-render <directory>");
+        }
+    }
+    else {
+        return false;
+    }
+
+    app->setApplicationReturnValue(exitCode);
+    JUCEApplicationBase::quit();
+    return true;
+}
+
 //==============================================================================
 juce::AudioProcessor* JUCE_CALLTYPE createPluginFilter()
 {
@@ -21,5 +63,194 @@ juce::AudioProcessor* JUCE_CALLTYPE createPluginFilter()
     Desktop::getInstance().getDefaultLookAndFeel().setDefaultSansSerifTypefaceName(typeFaceName);
 #endif
 
-    return new JuceDemoPluginAudioProcessor();
+    auto* processor = new JuceDemoPluginAudioProcessor();
+    runCommandLineTool(*processor);
+    return processor;
 }
+
+//==============================================================================
+// CHORDP_RT_SAFETY_CHECKS=1 でスタンドアロンだけを作るビルド(CHORDP_RT_SAFETY_HOOKS)では、
+// オーディオコールバック中の禁止操作をRealtimeSafetyCheckerへ知らせる。
+// operator new/deleteはどのプラットフォームでも差し替える。Linuxではさらにmalloc系、pthread_mutex_lock、
+// ファイル入出力のPOSIX関数を実行ファイル側で定義して横取りする。
+// ホストのプロセス全体に効いてしまうので、VST3やAUを含むビルドには入れない。
+#if CHORDP_RT_SAFETY_HOOKS
+
+#include <new>
+
+#if JUCE_LINUX
+ #include <cstdarg>
+ #include <dlfcn.h>
+ #include <fcntl.h>
+ #include <pthread.h>
+ #include <unistd.h>
+
+extern "C" void* __libc_malloc(size_t);
+extern "C" void* __libc_calloc(size_t, size_t);
+extern "C" void* __libc_realloc(void*, size_t);
+extern "C" void  __libc_free(void*);
+
+static void* allocateUnchecked(size_t size) { return __libc_malloc(size); }
+static void freeUnchecked(void* p)          { __libc_free(p); }
+#else
+static void* allocateUnchecked(size_t size) { return std::malloc(size); }
+static void freeUnchecked(void* p)          { std::free(p); }
+#endif
+
+void* operator new (std::size_t size)
+{
+    RealtimeSafetyChecker::check("operator new");
+
+    if (auto* p = allocateUnchecked(size > 0 ? size : 1))
+        return p;
+
+    throw std::bad_alloc();
+}
+
+void* operator new[] (std::size_t size)
+{
+    RealtimeSafetyChecker::check("operator new[]");
+
+    if (auto* p = allocateUnchecked(size > 0 ? size : 1))
+        return p;
+
+    throw std::bad_alloc();
+}
+
+void* operator new (std::size_t size, const std::nothrow_t&) noexcept
+{
+    RealtimeSafetyChecker::check("operator new");
+    return allocateUnchecked(size > 0 ? size : 1);
+}
+
+void* operator new[] (std::size_t size, const std::nothrow_t&) noexcept
+{
+    RealtimeSafetyChecker::check("operator new[]");
+    return allocateUnchecked(size > 0 ? size : 1);
+}
+
+void operator delete (void* p) noexcept
+{
+    if (p != nullptr)
+        RealtimeSafetyChecker::check("operator delete");
+
+    freeUnchecked(p);
+}
+
+void operator delete[] (void* p) noexcept
+{
+    if (p != nullptr)
+        RealtimeSafetyChecker::check("operator delete[]");
+
+    freeUnchecked(p);
+}
+
+void operator delete (void* p, std::size_t) noexcept   { operator delete (p); }
+void operator delete[] (void* p, std::size_t) noexcept { operator delete[] (p); }
+void operator delete (void* p, const std::nothrow_t&) noexcept   { operator delete (p); }
+void operator delete[] (void* p, const std::nothrow_t&) noexcept { operator delete[] (p); }
+
+#if JUCE_LINUX
+// 本物の関数はdlsym(RTLD_NEXT)で一度だけ引く(初期化のロックを避けるため関数内staticは使わない)
+template <typename FunctionType>
+static FunctionType getNextSymbol(std::atomic<FunctionType>& cache, const char* name)
+{
+    auto function = cache.load(std::memory_order_acquire);
+
+    if (function == nullptr)
+    {
+        function = reinterpret_cast<FunctionType>(dlsym(RTLD_NEXT, name));
+        cache.store(function, std::memory_order_release);
+    }
+
+    return function;
+}
+
+extern "C"
+{
+    void* malloc(size_t size) noexcept
+    {
+        RealtimeSafetyChecker::check("malloc");
+        return __libc_malloc(size);
+    }
+
+    void* calloc(size_t count, size_t size) noexcept
+    {
+        RealtimeSafetyChecker::check("calloc");
+        return __libc_calloc(count, size);
+    }
+
+    void* realloc(void* p, size_t size) noexcept
+    {
+        RealtimeSafetyChecker::check("realloc");
+        return __libc_realloc(p, size);
+    }
+
+    void free(void* p) noexcept
+    {
+        if (p != nullptr)
+            RealtimeSafetyChecker::check("free");
+
+        __libc_free(p);
+    }
+
+    int pthread_mutex_lock(pthread_mutex_t* mutex) noexcept
+    {
+        // try-lock(ScopedTryLockなど)は待たないので見逃す
+        static std::atomic<int (*)(pthread_mutex_t*)> next{ nullptr };
+        RealtimeSafetyChecker::check("pthread_mutex_lock");
+        return getNextSymbol(next, "pthread_mutex_lock")(mutex);
+    }
+
+    FILE* fopen(const char* path, const char* mode)
+    {
+        static std::atomic<FILE* (*)(const char*, const char*)> next{ nullptr };
+        RealtimeSafetyChecker::check("fopen");
+        return getNextSymbol(next, "fopen")(path, mode);
+    }
+
+    ssize_t write(int fd, const void* data, size_t size)
+    {
+        static std::atomic<ssize_t (*)(int, const void*, size_t)> next{ nullptr };
+        RealtimeSafetyChecker::check("write");
+        return getNextSymbol(next, "write")(fd, data, size);
+    }
+
+    int close(int fd)
+    {
+        static std::atomic<int (*)(int)> next{ nullptr };
+        RealtimeSafetyChecker::check("close");
+        return getNextSymbol(next, "close")(fd);
+    }
+
+   // _FORTIFY_SOURCEではopen/readがインラインの包み関数になり再定義できないので、そのときは横取りしない
+   #if ! (defined (_FORTIFY_SOURCE) && _FORTIFY_SOURCE > 0)
+    int open(const char* path, int flags, ...)
+    {
+        static std::atomic<int (*)(const char*, int, ...)> next{ nullptr };
+        RealtimeSafetyChecker::check("open");
+
+        mode_t mode = 0;
+
+        if ((flags & O_CREAT) != 0)
+        {
+            va_list args;
+            va_start(args, flags);
+            mode = (mode_t)va_arg(args, int);
+            va_end(args);
+        }
+
+        return getNextSymbol(next, "open")(path, flags, mode);
+    }
+
+    ssize_t read(int fd, void* data, size_t size)
+    {
+        static std::atomic<ssize_t (*)(int, void*, size_t)> next{ nullptr };
+        RealtimeSafetyChecker::check("read");
+        return getNextSymbol(next, "read")(fd, data, size);
+    }
+   #endif
+}
+#endif
+
+#endif